@@ -93,12 +93,22 @@ int main()
   int rank = 0;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     
-  KStateSpacePartition<64, BoardState<64, ChessNPD>> partitioner(fullPieceset[0], global_sz); 
   std::unordered_set<BoardState<64, ChessNPD>, BoardStateHasher<64, ChessNPD>> localCheckmates;
   
+#ifdef CLUSTER_DYNAMIC_CHECKMATES
+  // ranks take chunks of the positions from a shared counter instead of a fixed range of squares. The hash 
+  // partitioner takes any number of ranks, where the first piece partitioner stops at one rank per square
+  HashStateSpacePartition<64, ChessNPD> partitioner(global_sz); 
+  auto t0 = std::chrono::high_resolution_clock::now();
+  MpiTransport transport;
+  localCheckmates = generateDynamicPartitionCheckmates<64, ChessNPD>(transport, partitioner, 
+      std::move(localCheckmates), fullPieceset, winCondEvaluator, validityEvaluator); 
+#else
+  KStateSpacePartition<64, BoardState<64, ChessNPD>> partitioner(fullPieceset[0], global_sz); 
   auto t0 = std::chrono::high_resolution_clock::now();
   localCheckmates = generatePartitionCheckmates<64>(rank, partitioner, 
-      std::move(localCheckmates), fullPieceset, winCondEvaluator); 
+      std::move(localCheckmates), fullPieceset, winCondEvaluator, validityEvaluator); 
+#endif
   
   // wait until everyone is done before logging the time 
   MPI_Barrier(MPI_COMM_WORLD);
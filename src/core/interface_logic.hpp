@@ -42,19 +42,16 @@ void loopAllPMOs(const BoardState<FS, NPDT>& b, ForEachPMOFunc actOnPMO, bool re
 }
 template <::std::size_t FS, typename NPDT, typename CT, ::std::size_t PTC, typename ForEachPMOFunc, typename ForEachPMOUnpromotionFunc>
 void loopAllPMOs(const BoardState<FS, NPDT>& b, ForEachPMOFunc actOnPMO, bool reverse, ForEachPMOUnpromotionFunc actOnUnpromotionPMO) {
-    // TODO: consider using a list of the positions of every type of piece, rather than brute-force checking all tiles
-    for (size_t flatStartPos = 0; flatStartPos < FS; ++flatStartPos) {
+    // Only the squares holding pieces of the side we generate for are visited (a bit scan with BITBOARD_STATE)
+    forEachPieceOfColor(b, b.m_player ^ reverse, [&](size_t flatStartPos) {
         piece_label_t thisPiece = b.m_board.at(flatStartPos);
-        if (isEmpty(thisPiece)) continue;
-        // Ignore this piece if it is not for the player-to-move. Invert this result if forPlayerToMove=false.
-        if (isWhite(thisPiece) ^ b.m_player ^ reverse) continue;
 
         PIECE_TYPE_ENUM type = getTypeEnumFromPieceLabel(thisPiece);
 
         for (size_t i = 0; i < getPieceTypeData<FS, NPDT, CT>(type).pmoListSize; ++i) {
             auto pmo = getPieceTypeData<FS, NPDT, CT>(type).pmoList[i];
             // Break if function returns false
-            if (!actOnPMO(b, pmo, flatStartPos)) return;
+            if (!actOnPMO(b, pmo, flatStartPos)) return false;
         }
 
         // Now check for unpromotion PMOs
@@ -66,12 +63,12 @@ void loopAllPMOs(const BoardState<FS, NPDT>& b, ForEachPMOFunc actOnPMO, bool re
                     // ASSUMPTION: every PMO held by a promotable piece is a PromotablePMO.
                     auto pmo = (PromotablePMO<FS, NPDT, CT, PTC>*) getPieceTypeData<FS, NPDT, CT>(unpromotedType).pmoList[i];
                     // Break if function returns false
-                    if (!actOnUnpromotionPMO(b, pmo, flatStartPos, unpromotedPlt, thisPiece)) return;
+                    if (!actOnUnpromotionPMO(b, pmo, flatStartPos, unpromotedPlt, thisPiece)) return false;
                 }
             }
         }
-    }
-    return;
+        return true;
+    });
 }
 
 /* -------------------------------------------------------------------------- */
@@ -107,7 +104,7 @@ bool inCheck(const BoardState<FS, NPDT>& b, bool isWhiteAttacking) {
             // ASSUMPTION: a piece can only capture a royal by ending its turn on royal's position
             auto endPos = startPos + displacement;
 
-            if (isRoyal(bRev.m_board.at(endPos.flatten()))) {
+            if (isRoyalAt(bRev, endPos.flatten())) {
             // TODO: if counting was fast, we could just use that on royal pieces
                 isCheck = true;
                 // stop search
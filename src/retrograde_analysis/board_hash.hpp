@@ -0,0 +1,115 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Allocation free hashing and comparison of fixed size byte blocks, used for the board placement
+ * and non placement data. The sizes are compile time constants so the loops below are fully unrolled.
+ * Comparison uses 32 byte (AVX2) or 16 byte (SSE2) vector loads when the target has them. Hashing
+ * reads 8 byte words into 4 independent lanes that are folded together at the end.
+ */
+
+#ifndef BOARD_HASH_HPP_
+#define BOARD_HASH_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// loads the bytes [0, Sz) of p into a word, the rest of the word is zero
+template <::std::size_t Sz>
+inline ::std::uint64_t loadWord(const unsigned char* p)
+{
+  ::std::uint64_t w = 0;
+  ::std::memcpy(&w, p, Sz);
+  return w;
+}
+
+template <::std::size_t Sz>
+inline bool bytesEqual(const unsigned char* x, const unsigned char* y)
+{
+  ::std::size_t i = 0;
+#ifdef __AVX2__
+  for (; i + 32 <= Sz; i += 32)
+  {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + i));
+    if (static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b))) != 0xFFFFFFFFu)
+      return false;
+  }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+  for (; i + 16 <= Sz; i += 16)
+  {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF)
+      return false;
+  }
+#endif
+  for (; i + 8 <= Sz; i += 8)
+    if (loadWord<8>(x + i) != loadWord<8>(y + i))
+      return false;
+
+  constexpr ::std::size_t TAIL = Sz % 8;
+  if constexpr (TAIL != 0)
+    return loadWord<TAIL>(x + Sz - TAIL) == loadWord<TAIL>(y + Sz - TAIL);
+  return true;
+}
+
+inline ::std::uint64_t mixWord(::std::uint64_t h, ::std::uint64_t w)
+{
+  h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 32);
+}
+
+template <::std::size_t Sz>
+inline ::std::uint64_t hashBytes(const unsigned char* p, ::std::uint64_t seed)
+{
+  constexpr ::std::size_t LANES = 4;
+  ::std::uint64_t lanes[LANES] = { seed, seed ^ 0x2545f4914f6cdd1dull, seed ^ 0xbf58476d1ce4e5b9ull, seed ^ 0x94d049bb133111ebull };
+
+  ::std::size_t i = 0;
+  for (; i + 8 * LANES <= Sz; i += 8 * LANES)
+    for (::std::size_t l = 0; l < LANES; ++l)
+      lanes[l] = mixWord(lanes[l], loadWord<8>(p + i + 8 * l));
+  for (::std::size_t l = 0; i + 8 <= Sz; i += 8, ++l)
+    lanes[l] = mixWord(lanes[l], loadWord<8>(p + i));
+
+  constexpr ::std::size_t TAIL = Sz % 8;
+  if constexpr (TAIL != 0)
+    lanes[LANES - 1] = mixWord(lanes[LANES - 1], loadWord<TAIL>(p + Sz - TAIL) + 1);
+
+  auto h = lanes[0];
+  for (::std::size_t l = 1; l < LANES; ++l)
+    h = mixWord(h, lanes[l]);
+  // final avalanche so the low bits used for bucket selection depend on every byte
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ull;
+  return h ^ (h >> 32);
+}
+
+// The non placement data can be hashed and compared through its bytes only if it has no padding.
+template <typename NonPlacementDataType>
+constexpr bool hasByteRepresentation()
+{
+  return !::std::is_empty_v<NonPlacementDataType> &&
+    ::std::has_unique_object_representations_v<NonPlacementDataType>;
+}
+
+#endif
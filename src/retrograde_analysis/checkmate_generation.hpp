@@ -24,8 +24,20 @@
 
 #include <unordered_set>
 #include <iostream>
+#include <cstring>
 #include "state_transition.hpp"
 #include "permutation_generator.hpp"
+#include "position_index.hpp"
+
+// Number of position indices a rank takes at a time in generateDynamicPartitionCheckmates
+#ifndef CLUSTER_CHECKMATE_CHUNK_SZ
+#  define CLUSTER_CHECKMATE_CHUNK_SZ 16384
+#endif
+
+// Number of placement indices an OpenMP task walks in generateParallelConfigCheckmates
+#ifndef CHECKMATE_CHUNK_SZ
+#  define CHECKMATE_CHUNK_SZ 4096
+#endif
 
 // generate all N-man piece configurations for a given game 
 template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t N,
@@ -133,76 +145,188 @@ auto generateConfigCheckmates(const ::std::vector<piece_label_t>& pieceSet,
   return losses;
 }
 
+// evaluates the placements [first, last) of the first kPermute pieces of pieceSet, in the order of 
+// KPermutation, and adds the checkmates that inPartition accepts to losses.
+template<::std::size_t FlattenedSz, typename NonPlacementDataType, typename EvalFn, typename IsValidBoardFn,
+  typename InPartitionFn>
+void inline generateRangeCheckmates(::std::size_t kPermute, ::std::uint64_t first, ::std::uint64_t last,
+    ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>>& losses,
+    const ::std::vector<piece_label_t>& pieceSet,
+    EvalFn& checkmateEval,
+    IsValidBoardFn& boardValidityEval,
+    InPartitionFn inPartition)
+{
+  if (first == last)
+    return;
+  KPermutation<FlattenedSz> placement(kPermute);
+  placement.unrank(first);
+
+  for (auto idx = first; idx != last; ++idx, placement.next())
+  {
+    BoardState<FlattenedSz, NonPlacementDataType> currentBoard;
+    currentBoard.m_player = false;
+
+    for (::std::size_t i = 0; i != kPermute; ++i)
+      currentBoard.m_board[placement[i]] = pieceSet[i]; // scatter pieces
+
+    if constexpr (!::std::is_same<null_type, IsValidBoardFn>::value)
+    {
+      if (!boardValidityEval(currentBoard))
+        continue;
+    }
+    
+    // checking if black loses (white wins) 
+    if (inPartition(currentBoard) && checkmateEval(currentBoard))
+      losses.insert(currentBoard);
+    
+    currentBoard.m_player = true;
+    
+    // checking if white loses (black wins)
+    if (inPartition(currentBoard) && checkmateEval(currentBoard))
+    {
+      losses.insert(currentBoard);
+    }
+  }
+}
+
 // a parallelized search of all permutations in the game. Parallelization occurs over the permutations themselves
-// based upon lexicographical ordering.
-template<::std::size_t FlattenedSz, typename NonPlacementDataType, typename EvalFn,
-  typename IsValidBoardFn=null_type>
-auto inline generatePartitionCheckmates(int k, const KStateSpacePartition<FlattenedSz, BoardState<FlattenedSz, NonPlacementDataType>>& partitioner,
+// based upon lexicographical ordering. A KStateSpacePartition only walks the range of placement indices whose 
+// first piece is on a square of part k. Any other partitioner walks all permutations and only evaluates the 
+// boards assigned to part k, which is cheap next to the evaluation itself.
+template<::std::size_t FlattenedSz, typename NonPlacementDataType, typename Partitioner, typename EvalFn,
+  typename IsValidBoardFn=null_type,
+  typename ::std::enable_if<::std::is_base_of<StateSpacePartition<BoardState<FlattenedSz, NonPlacementDataType>>, 
+    Partitioner>::value>::type* = nullptr>
+auto inline generatePartitionCheckmates(int k, const Partitioner& partitioner,
     ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>>&& losses,
     const ::std::vector<piece_label_t>& pieceSet,
     EvalFn checkmateEval,
     IsValidBoardFn boardValidityEval = {})
 {
-  ::std::array<::std::size_t, FlattenedSz> indexPermutations;
-  auto [startFirstIdx, endFirstIdx] = partitioner.getRange(k);
-   
+  constexpr bool b_firstPieceRanges = 
+    ::std::is_same<Partitioner, KStateSpacePartition<FlattenedSz, BoardState<FlattenedSz, NonPlacementDataType>>>::value;
+  auto inPartition = [&](const BoardState<FlattenedSz, NonPlacementDataType>& b)
+  {
+    return b_firstPieceRanges || partitioner(b) == k;
+  };
+
   // generates [3, ..., kPermute] sets of new checkmate positions.
   for (::std::size_t kPermute = 3; kPermute != pieceSet.size() + 1; ++kPermute)
   {
-    indexPermutations[0] = startFirstIdx;
-    int j = 0;
-    for (::std::size_t i = 1; i < indexPermutations.size(); ++i)
+    ::std::uint64_t first = 0;
+    ::std::uint64_t last = KPermutation<FlattenedSz>(kPermute).size();
+    // the first piece is the most significant digit, so each of its squares holds a block of indices
+    if constexpr (b_firstPieceRanges)
     {
-      if (j == startFirstIdx)
-        ++j;
-      indexPermutations[i] = j;
-      ++j;
+      auto perSquare = last / FlattenedSz;
+      auto [startSq, endSq] = partitioner.getRange(k);
+      first = startSq * perSquare;
+      last = endSq * perSquare;
     }
+    generateRangeCheckmates<FlattenedSz, NonPlacementDataType>(kPermute, first, last, losses, pieceSet,
+        checkmateEval, boardValidityEval, inPartition);
+  }
+  return ::std::move(losses);
+}
+
+// Finds the same checkmates as generatePartitionCheckmates for the part of the calling rank, but the ranks of 
+// transport share the work dynamically rather than each walking a fixed range. The placements of every prefix
+// of at least 3 pieces of the pieceset are indexed with PositionIndexer, and each rank takes the next
+// CLUSTER_CHECKMATE_CHUNK_SZ indices from a counter shared by all ranks until none are left, so ranks that get
+// cheap chunks take more of them. Every rank then sends the checkmates it found to the rank the partitioner
+// assigns them to. Must be called by all ranks.
+template<::std::size_t FlattenedSz, typename NonPlacementDataType, typename Partitioner, typename EvalFn,
+  typename Transport, typename IsValidBoardFn=null_type,
+  typename ::std::enable_if<::std::is_base_of<StateSpacePartition<BoardState<FlattenedSz, NonPlacementDataType>>, 
+    Partitioner>::value>::type* = nullptr>
+auto inline generateDynamicPartitionCheckmates(Transport& transport, const Partitioner& partitioner,
+    ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>>&& losses,
+    const ::std::vector<piece_label_t>& pieceSet,
+    EvalFn checkmateEval,
+    IsValidBoardFn boardValidityEval = {})
+{
+  using board_t = BoardState<FlattenedSz, NonPlacementDataType>;
+  static_assert(::std::is_trivially_copyable_v<board_t>, "checkmates are traded as raw bytes");
+  int numParts = transport.size();
+  assert(partitioner.numParts() == numParts);
 
-    auto startBoard = indexPermutations;
+  // the indices of a prefix follow those of the shorter ones
+  ::std::vector<PositionIndexer<FlattenedSz>> indexers;
+  ::std::vector<position_index_t> offsets = { 0 };
+  for (::std::size_t kPermute = 3; kPermute <= pieceSet.size(); ++kPermute)
+  {
+    indexers.emplace_back(::std::vector<piece_label_t>(pieceSet.begin(), pieceSet.begin() + kPermute));
+    offsets.push_back(offsets.back() + indexers.back().size());
+  }
 
-    // k-permutation iteration inspired by answer from Vaughn Cato last updated on May 23, 2017
-    // answer: https://stackoverflow.com/a/28712605
-    // author: https://stackoverflow.com/users/951890/vaughn-cato
-    bool hasNext = false;
-    do 
+  ::std::vector<::std::vector<board_t>> found(numParts);
+  auto counter = transport.createCounter();
+  // a rank takes chunks in increasing order, so the prefix of its indices only grows
+  ::std::size_t prefix = 0;
+  while (true)
+  {
+    auto first = static_cast<position_index_t>(transport.fetchAdd(counter, CLUSTER_CHECKMATE_CHUNK_SZ));
+    if (first >= offsets.back())
+      break;
+    auto last = ::std::min(offsets.back(), first + CLUSTER_CHECKMATE_CHUNK_SZ);
+    for (auto idx = first; idx < last; ++idx)
     {
-      BoardState<FlattenedSz, NonPlacementDataType> currentBoard;
-      currentBoard.m_player = false;
-
-      for (::std::size_t i = 0; i != kPermute; ++i)
-        currentBoard.m_board[indexPermutations[i]] = pieceSet[i]; // scatter pieces
+      while (idx >= offsets[prefix + 1])
+        ++prefix;
+      board_t currentBoard;
+      indexers[prefix].unrank(idx - offsets[prefix], currentBoard);
 
       if constexpr (!::std::is_same<null_type, IsValidBoardFn>::value)
       {
-        if (!boardValidityEval(currentBoard))
-        {
-          ::std::reverse(indexPermutations.begin() + kPermute, indexPermutations.end());
-          hasNext = ::std::next_permutation(indexPermutations.begin(), indexPermutations.end());
+        // as in the walk, a placement is checked for validity with black to move
+        auto placement = currentBoard;
+        placement.m_player = false;
+        if (!boardValidityEval(placement))
           continue;
-        }
       }
-      
-      // checking if black loses (white wins) 
-      if (checkmateEval(currentBoard))
-        losses.insert(currentBoard);
-      
-      currentBoard.m_player = true;
-      
-      // checking if white loses (black wins)
       if (checkmateEval(currentBoard))
-      {
-        losses.insert(currentBoard);
-      }
+        found[partitioner(currentBoard)].push_back(currentBoard);
+    }
+  }
+  transport.freeCounter(counter);
 
-      ::std::reverse(indexPermutations.begin() + kPermute, indexPermutations.end());
-      hasNext = ::std::next_permutation(indexPermutations.begin(), indexPermutations.end());
-    } while (hasNext && partitioner.checkInRange(startBoard, indexPermutations));
+  // the checkmates are traded as raw bytes
+  ::std::vector<int> sendCounts(numParts);
+  ::std::vector<int> sendDispls(numParts);
+  ::std::vector<unsigned char> sendBytes;
+  for (int i = 0; i < numParts; ++i)
+  {
+    sendDispls[i] = static_cast<int>(sendBytes.size());
+    auto bytes = reinterpret_cast<const unsigned char*>(found[i].data());
+    sendBytes.insert(sendBytes.end(), bytes, bytes + found[i].size() * sizeof(board_t));
+    sendCounts[i] = static_cast<int>(sendBytes.size()) - sendDispls[i];
+  }
+
+  ::std::vector<int> recvCounts(numParts);
+  ::std::vector<int> recvDispls(numParts);
+  transport.alltoall(sendCounts.data(), recvCounts.data());
+  int recvTotal = 0;
+  for (int i = 0; i < numParts; ++i)
+  {
+    recvDispls[i] = recvTotal;
+    recvTotal += recvCounts[i];
+  }
+  ::std::vector<unsigned char> recvBytes(recvTotal);
+  transport.alltoallv(sendBytes.data(), sendCounts.data(), sendDispls.data(),
+      recvBytes.data(), recvCounts.data(), recvDispls.data());
+
+  for (int offset = 0; offset < recvTotal; offset += sizeof(board_t))
+  {
+    board_t b;
+    ::std::memcpy(&b, recvBytes.data() + offset, sizeof(board_t));
+    losses.insert(b);
   }
   return ::std::move(losses);
 }
 
-// identifies all checkmates across a given configuration with OpenMP parallelism
+// identifies all checkmates across a given configuration with OpenMP parallelism. The placements are split into 
+// tasks of CHECKMATE_CHUNK_SZ indices, so any number of threads share the work evenly whatever the cost of each 
+// placement. Each thread collects the checkmates of its tasks, and the threads merge them once all are done.
 template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t N, 
   ::std::size_t rowSz, ::std::size_t colSz, typename CheckmateEvalFn,
   typename HorizontalSymFn = false_fn, typename VerticalSymFn = false_fn, typename IsValidBoardFn = null_type,
@@ -213,19 +337,31 @@ auto generateParallelConfigCheckmates(const ::std::vector<piece_label_t>& pieceS
     HorizontalSymFn hzSymFn={}, VerticalSymFn vSymFn={}) 
 {
   ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>> losses;
+  ::std::vector<decltype(losses)> threadLosses(omp_get_max_threads());
+  auto inPartition = [](const auto&) { return true; };
 #pragma omp parallel
     {
-      decltype(losses) localLosses;
-
-      int totalThreads = omp_get_num_threads();
-      int threadId = omp_get_thread_num();
-      
-      KStateSpacePartition<FlattenedSz, BoardState<FlattenedSz, NonPlacementDataType>> partitioner(pieceSet[0], totalThreads);
-      localLosses = generatePartitionCheckmates<FlattenedSz, NonPlacementDataType>(threadId, partitioner, 
-          std::move(localLosses), pieceSet, eval, isValidBoardFn);
+#pragma omp single
+      {
+        // generates [3, ..., kPermute] sets of new checkmate positions.
+        for (::std::size_t kPermute = 3; kPermute != pieceSet.size() + 1; ++kPermute)
+        {
+          ::std::uint64_t numPlacements = KPermutation<FlattenedSz>(kPermute).size();
+          for (::std::uint64_t first = 0; first < numPlacements; first += CHECKMATE_CHUNK_SZ)
+          {
+            auto last = ::std::min<::std::uint64_t>(numPlacements, first + CHECKMATE_CHUNK_SZ);
+            // tied tasks stay on the thread that starts them, so its buffer needs no lock
+#pragma omp task firstprivate(kPermute, first, last, eval, isValidBoardFn)
+            generateRangeCheckmates<FlattenedSz, NonPlacementDataType>(kPermute, first, last, 
+                threadLosses[omp_get_thread_num()], pieceSet, eval, isValidBoardFn, inPartition);
+          }
+        }
+      }
+      // the barrier closing the single region waits for all tasks
+
 #pragma omp critical
       {
-        for (const auto& l : localLosses)
+        for (const auto& l : threadLosses[omp_get_thread_num()])
           losses.insert(l);
       }
     }
@@ -0,0 +1,305 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checkpointing of the single node solver. Positions are only ever added to the wins and losses, and every
+ * position labelled in iteration v has a depth-to-mate of v, so the solver state after iteration v is the
+ * list of positions labelled in each iteration up to v. The checkpoint is an append only log with one record
+ * per iteration holding the positions won and lost in it. Positions are written as their MaterialIndexer index,
+ * which takes 8 bytes rather than a whole board. Stores with a MaterialIndexer use their own. Hash stores may
+ * be given one, and positions it cannot index, such as those with non default non placement data, are written
+ * as raw boards after the indexed ones.
+ *
+ * Records are written and synced to disk by a background thread while the solver carries on with the next
+ * iteration. A record that was only partly written when the process stopped is dropped when resuming.
+ */
+
+#ifndef CHECKPOINT_HPP_
+#define CHECKPOINT_HPP_
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "position_index.hpp"
+#include "result_store.hpp"
+
+template <typename BoardType>
+struct checkpoint_indexer;
+
+template <::std::size_t FlattenedSz, typename NonPlacementDataType>
+struct checkpoint_indexer<BoardState<FlattenedSz, NonPlacementDataType>>
+{
+  using type = MaterialIndexer<FlattenedSz>;
+};
+
+template <typename BoardType, typename ResultStore>
+class CheckpointLog
+{
+public:
+  // boards grouped in any way, usually by thread or by shard
+  using board_lists_t = ::std::vector<::std::vector<BoardType>>;
+  using indexer_t = typename checkpoint_indexer<BoardType>::type;
+
+private:
+  static constexpr bool BY_INDEX = requires (const ResultStore& s) { s.indexer(); };
+
+  struct Header
+  {
+    char magic[8];
+    ::std::uint32_t version;
+    ::std::uint32_t boardSz;
+  };
+
+  // followed by the indices of the wins and losses, then the raw wins and losses
+  struct RecordHeader
+  {
+    ::std::int32_t v;
+    ::std::uint64_t numWins;
+    ::std::uint64_t numLosses;
+    ::std::uint64_t numRawWins;
+    ::std::uint64_t numRawLosses;
+  };
+
+  // the positions of a record, split by how they are written
+  struct Entries
+  {
+    ::std::vector<position_index_t> wins;
+    ::std::vector<position_index_t> losses;
+    ::std::vector<BoardType> rawWins;
+    ::std::vector<BoardType> rawLosses;
+  };
+
+  static constexpr char MAGIC[8] = { 'S', 'C', 'R', 'A', 'P', 'C', 'K', 'P' };
+  static constexpr ::std::uint32_t VERSION = 2;
+
+  ::std::string m_path;
+  ::std::FILE* m_file = nullptr;
+  bool m_resume;
+  // the indexer of hash stores, if any
+  ::std::optional<indexer_t> m_indexer;
+  ::std::future<void> m_pendingWrite;
+
+  const indexer_t* indexerOf(const ResultStore& store) const
+  {
+    if constexpr (BY_INDEX)
+      return &store.indexer();
+    else
+      return m_indexer ? &*m_indexer : nullptr;
+  }
+
+  ::std::runtime_error error(const ::std::string& what) const
+  {
+    return ::std::runtime_error(what + " " + m_path + ": " + ::std::strerror(errno));
+  }
+
+  void writeBytes(const void* data, ::std::size_t sz)
+  {
+    if (::std::fwrite(data, 1, sz, m_file) != sz)
+      throw error("write");
+  }
+
+  bool readBytes(void* data, ::std::size_t sz)
+  {
+    return ::std::fread(data, 1, sz, m_file) == sz;
+  }
+
+  // splits the boards of lists into indices and raw boards. A board is only indexed if it unranks back to
+  // itself. Dense stores cannot hold the boards their indexer misses, so those are dropped
+  void split(const indexer_t* indexer, const board_lists_t& lists, ::std::vector<position_index_t>& indexed,
+      ::std::vector<BoardType>& raw) const
+  {
+    for (const auto& list : lists)
+    {
+      for (const auto& b : list)
+      {
+        auto idx = indexer ? (*indexer)(b) : NULL_POSITION_INDEX;
+        if constexpr (BY_INDEX)
+        {
+          if (idx != NULL_POSITION_INDEX)
+            indexed.push_back(idx);
+        }
+        else if (idx != NULL_POSITION_INDEX && unrank(*indexer, idx) == b)
+          indexed.push_back(idx);
+        else
+          raw.push_back(b);
+      }
+    }
+  }
+
+  static BoardType unrank(const indexer_t& indexer, position_index_t idx)
+  {
+    BoardType b{};
+    indexer.unrank(idx, b);
+    return b;
+  }
+
+  template <typename T>
+  void writeVector(const ::std::vector<T>& v)
+  {
+    writeBytes(v.data(), v.size() * sizeof(T));
+  }
+
+  template <typename T>
+  bool readVector(::std::vector<T>& v, ::std::uint64_t n)
+  {
+    v.resize(n);
+    return readBytes(v.data(), n * sizeof(T));
+  }
+
+  void writeRecord(const ResultStore& store, int v, const board_lists_t& wins, const board_lists_t& losses)
+  {
+    Entries entries;
+    split(indexerOf(store), wins, entries.wins, entries.rawWins);
+    split(indexerOf(store), losses, entries.losses, entries.rawLosses);
+    RecordHeader record{ v, entries.wins.size(), entries.losses.size(), entries.rawWins.size(),
+      entries.rawLosses.size() };
+    writeBytes(&record, sizeof(record));
+    writeVector(entries.wins);
+    writeVector(entries.losses);
+    writeVector(entries.rawWins);
+    writeVector(entries.rawLosses);
+    if (::std::fflush(m_file) != 0 || ::fsync(::fileno(m_file)) != 0)
+      throw error("sync");
+  }
+
+  static void mark(ResultStore& store, const BoardType& b, WDL wdl, int v)
+  {
+    if (wdl == WDL::WIN)
+      store.markWin(b, v);
+    else
+      store.markLoss(b, v);
+  }
+
+  void mark(ResultStore& store, position_index_t idx, WDL wdl, int v) const
+  {
+    if constexpr (BY_INDEX)
+      store.mark(idx, wdl, v);
+    else
+      mark(store, unrank(*m_indexer, idx), wdl, v);
+  }
+
+public:
+  /*
+   * Opens the log at path. Unless resuming, an existing log is overwritten. A hash store's positions are
+   * written as their index in indexer when it can rank them. Resuming needs the same indexer.
+   */
+  CheckpointLog(const ::std::string& path, bool resume, ::std::optional<indexer_t> indexer = ::std::nullopt)
+    : m_path(path), m_resume(resume), m_indexer(::std::move(indexer))
+  {
+    m_file = ::std::fopen(path.c_str(), resume ? "r+b" : "w+b");
+    if (!m_file)
+      throw error("open");
+    if (resume)
+      return;
+    Header header{ {}, VERSION, sizeof(BoardType) };
+    ::std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    writeBytes(&header, sizeof(header));
+  }
+
+  bool resuming() const { return m_resume; }
+
+  CheckpointLog(const CheckpointLog&) = delete;
+  CheckpointLog& operator=(const CheckpointLog&) = delete;
+
+  ~CheckpointLog()
+  {
+    if (m_pendingWrite.valid())
+      m_pendingWrite.wait();
+    ::std::fclose(m_file);
+  }
+
+  /*
+   * Labels the positions of every complete record in the store and drops a trailing partial record.
+   * Returns the last completed iteration (-1 if there is none) and the positions lost in it, from which
+   * the solver rebuilds its frontier.
+   */
+  ::std::pair<int, ::std::vector<BoardType>> restore(ResultStore& store)
+  {
+    ::std::rewind(m_file);
+    Header header;
+    if (!readBytes(&header, sizeof(header)) || ::std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+        || header.version != VERSION || header.boardSz != sizeof(BoardType))
+      throw ::std::runtime_error("not a checkpoint of this build: " + m_path);
+
+    int lastV = -1;
+    Entries last;
+    long validEnd = ::std::ftell(m_file);
+    RecordHeader record;
+    Entries entries;
+    while (readBytes(&record, sizeof(record)))
+    {
+      if (!readVector(entries.wins, record.numWins) || !readVector(entries.losses, record.numLosses)
+          || !readVector(entries.rawWins, record.numRawWins) || !readVector(entries.rawLosses, record.numRawLosses))
+        break;
+      if ((record.numWins || record.numLosses) && !indexerOf(store))
+        throw ::std::runtime_error("checkpoint holds indexed positions but no indexer was given: " + m_path);
+      for (const auto& idx : entries.wins)
+        mark(store, idx, WDL::WIN, record.v);
+      for (const auto& idx : entries.losses)
+        mark(store, idx, WDL::LOSS, record.v);
+      for (const auto& b : entries.rawWins)
+        mark(store, b, WDL::WIN, record.v);
+      for (const auto& b : entries.rawLosses)
+        mark(store, b, WDL::LOSS, record.v);
+      lastV = record.v;
+      ::std::swap(last, entries);
+      validEnd = ::std::ftell(m_file);
+    }
+
+    // later records are appended after the last complete one
+    if (::std::fflush(m_file) != 0 || ::ftruncate(::fileno(m_file), validEnd) != 0
+        || ::std::fseek(m_file, validEnd, SEEK_SET) != 0)
+      throw error("truncate");
+
+    ::std::vector<BoardType> lastLossBoards = ::std::move(last.rawLosses);
+    for (const auto& idx : last.losses)
+      lastLossBoards.push_back(unrank(*indexerOf(store), idx));
+    return { lastV, ::std::move(lastLossBoards) };
+  }
+
+  /*
+   * Appends the record of iteration v in the background. Waits for the previous record to be written first,
+   * so at most one iteration's positions are held by the log. The store's indexer must not change meanwhile.
+   */
+  void append(const ResultStore& store, int v, board_lists_t wins, board_lists_t losses)
+  {
+    wait();
+    m_pendingWrite = ::std::async(::std::launch::async,
+      [this, &store, v, wins = ::std::move(wins), losses = ::std::move(losses)]
+      {
+        writeRecord(store, v, wins, losses);
+      });
+  }
+
+  // blocks until the last appended record is on disk, rethrowing any error of writing it
+  void wait()
+  {
+    if (m_pendingWrite.valid())
+      m_pendingWrite.get();
+  }
+};
+
+#endif
@@ -0,0 +1,305 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Coordinated checkpoints of the cluster solver. At the end of a major or minor iteration, after the
+ * synchronization of do_syncAndFree, no message is in flight and each rank's wins, losses, estimate data and
+ * next frontier make up the whole solver state. Every rank writes these to its own shard file in the
+ * checkpoint directory. Once all ranks have synced their shards, rank 0 points the manifest at them, so an
+ * interrupted checkpoint leaves the previous one in place.
+ *
+ * Every table is keyed by board and each board belongs to the rank the partitioner assigns it, so a restart
+ * with a different number of ranks reads every shard and keeps the entries of its own boards.
+ */
+
+#ifndef CLUSTER_CHECKPOINT_HPP_
+#define CLUSTER_CHECKPOINT_HPP_
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <unistd.h>
+
+#include <mpi.h>
+
+class ClusterCheckpoint
+{
+  struct Manifest
+  {
+    char magic[8];
+    ::std::uint32_t version;
+    ::std::int32_t numProcs;
+    ::std::int64_t seq;
+    ::std::int32_t v;
+    ::std::int32_t afterMajor;
+  };
+
+  struct ShardHeader
+  {
+    char magic[8];
+    ::std::uint32_t version;
+    ::std::uint32_t boardSz;
+    ::std::uint32_t commDataSz;
+    ::std::uint32_t estimateSz;
+  };
+
+  static constexpr char MAGIC[8] = { 'S', 'C', 'R', 'A', 'P', 'C', 'C', 'K' };
+  static constexpr ::std::uint32_t VERSION = 1;
+
+  ::std::string m_dir;
+  int m_id;
+  int m_numProcs;
+  int m_interval;
+  bool m_resume;
+  // number of synchronization points passed and number of the last committed checkpoint
+  ::std::int64_t m_syncPoints = 0;
+  ::std::int64_t m_seq = -1;
+  // number of ranks that wrote checkpoint m_seq
+  int m_seqNumProcs = 0;
+
+  ::std::string manifestPath(void) const { return m_dir + "/manifest"; }
+
+  ::std::string shardPath(::std::int64_t seq, int rank) const
+  {
+    return m_dir + "/ckpt." + ::std::to_string(seq) + ".rank" + ::std::to_string(rank);
+  }
+
+  // an I/O failure on one rank would leave the others blocked in the next collective
+  [[noreturn]] static void fail(const ::std::string& what, const ::std::string& path)
+  {
+    ::std::cerr << "ERROR: checkpoint " << what << " " << path << ": " << ::std::strerror(errno) << ::std::endl;
+    MPI_Abort(MPI_COMM_WORLD, 1);
+    ::std::abort();
+  }
+
+  template <typename T>
+  static void write(::std::FILE* f, const T* data, ::std::size_t n, const ::std::string& path)
+  {
+    static_assert(::std::is_trivially_copyable_v<T>, "checkpoints hold raw bytes");
+    if (n && ::std::fwrite(data, sizeof(T), n, f) != n)
+      fail("write", path);
+  }
+
+  template <typename T>
+  static void read(::std::FILE* f, T* data, ::std::size_t n, const ::std::string& path)
+  {
+    if (n && ::std::fread(data, sizeof(T), n, f) != n)
+      fail("read", path);
+  }
+
+  template <typename T>
+  static void writeCount(::std::FILE* f, const T& table, const ::std::string& path)
+  {
+    ::std::uint64_t n = table.size();
+    write(f, &n, 1, path);
+  }
+
+  static void sync(::std::FILE* f, const ::std::string& path)
+  {
+    if (::std::fflush(f) != 0 || ::fsync(::fileno(f)) != 0)
+      fail("sync", path);
+  }
+
+  bool readManifest(Manifest& m) const
+  {
+    auto path = manifestPath();
+    ::std::FILE* f = ::std::fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+    bool ok = ::std::fread(&m, sizeof(m), 1, f) == 1 && ::std::memcmp(m.magic, MAGIC, sizeof(MAGIC)) == 0
+      && m.version == VERSION;
+    ::std::fclose(f);
+    return ok;
+  }
+
+public:
+  /*
+   * Checkpoints are kept in dir, which all ranks must share, at every interval-th synchronization point.
+   * When resuming, restore must be called before the first save.
+   */
+  ClusterCheckpoint(::std::string dir, int id, int numProcs, int interval, bool resume)
+    : m_dir(::std::move(dir)), m_id(id), m_numProcs(numProcs), m_interval(interval > 0 ? interval : 1),
+      m_resume(resume)
+  {
+  }
+
+  // true if resuming from a committed checkpoint
+  bool resuming(void) const
+  {
+    Manifest m;
+    return m_resume && readManifest(m);
+  }
+
+  /*
+   * Writes the state at the end of iteration v (its major iteration if afterMajor, else its minor one)
+   * if the interval is due. Must be called by all ranks at the same synchronization point.
+   */
+  template <typename BoardSet, typename BoardMap, typename Frontier>
+  void save(short v, bool afterMajor, const BoardSet& wins, const BoardSet& losses,
+      const BoardMap& estimateData, const Frontier& frontier)
+  {
+    if (++m_syncPoints % m_interval != 0)
+      return;
+
+    auto seq = m_seq + 1;
+    auto path = shardPath(seq, m_id);
+    ::std::FILE* f = ::std::fopen(path.c_str(), "wb");
+    if (!f)
+      fail("open", path);
+
+    using board_t = typename BoardSet::value_type;
+    using comm_data_t = typename Frontier::value_type;
+    using estimate_t = typename BoardMap::mapped_type;
+    ShardHeader header{ {}, VERSION, sizeof(board_t), sizeof(comm_data_t), sizeof(estimate_t) };
+    ::std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    write(f, &header, 1, path);
+
+    for (const auto* set : { &wins, &losses })
+    {
+      writeCount(f, *set, path);
+      for (const auto& b : *set)
+        write(f, &b, 1, path);
+    }
+    writeCount(f, estimateData, path);
+    for (const auto& [b, estimate] : estimateData)
+    {
+      write(f, &b, 1, path);
+      write(f, &estimate, 1, path);
+    }
+    writeCount(f, frontier, path);
+    for (const auto& commData : frontier)
+      write(f, &commData, 1, path);
+    sync(f, path);
+    ::std::fclose(f);
+
+    // the manifest may only name shards that every rank has synced
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (m_id == 0)
+    {
+      Manifest m{ {}, VERSION, m_numProcs, seq, v, afterMajor };
+      ::std::memcpy(m.magic, MAGIC, sizeof(MAGIC));
+      auto tmpPath = manifestPath() + ".tmp";
+      ::std::FILE* mf = ::std::fopen(tmpPath.c_str(), "wb");
+      if (!mf)
+        fail("open", tmpPath);
+      write(mf, &m, 1, tmpPath);
+      sync(mf, tmpPath);
+      ::std::fclose(mf);
+      if (::std::rename(tmpPath.c_str(), manifestPath().c_str()) != 0)
+        fail("rename", tmpPath);
+    }
+    // the previous shards are only dropped once the manifest no longer names them
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (m_seq >= 0)
+    {
+      ::std::remove(shardPath(m_seq, m_id).c_str());
+      // after a restart with fewer ranks, rank 0 also drops the shards of the ranks that no longer exist
+      if (m_id == 0)
+      {
+        for (int rank = m_numProcs; rank < m_seqNumProcs; ++rank)
+          ::std::remove(shardPath(m_seq, rank).c_str());
+      }
+    }
+    m_seq = seq;
+    m_seqNumProcs = m_numProcs;
+  }
+
+  /*
+   * Loads this rank's share of the committed checkpoint into the given empty tables. Returns the iteration
+   * it was taken in and whether it followed that iteration's major (true) or minor (false) iteration. The
+   * frontier goes into winFrontier after a major iteration and into loseFrontier after a minor one.
+   */
+  template <typename Partitioner, typename BoardSet, typename BoardMap, typename Frontier>
+  ::std::pair<short, bool> restore(const Partitioner& p, BoardSet& wins, BoardSet& losses,
+      BoardMap& estimateData, Frontier& winFrontier, Frontier& loseFrontier)
+  {
+    Manifest m;
+    if (!readManifest(m))
+      fail("manifest", manifestPath());
+    auto& frontier = m.afterMajor ? winFrontier : loseFrontier;
+
+    using board_t = typename BoardSet::value_type;
+    using comm_data_t = typename Frontier::value_type;
+    using estimate_t = typename BoardMap::mapped_type;
+
+    // with the same number of ranks, each rank's boards are all in its own shard
+    bool reshard = m.numProcs != m_numProcs;
+    for (int rank = 0; rank < m.numProcs; ++rank)
+    {
+      if (!reshard && rank != m_id)
+        continue;
+      auto path = shardPath(m.seq, rank);
+      ::std::FILE* f = ::std::fopen(path.c_str(), "rb");
+      if (!f)
+        fail("open", path);
+
+      ShardHeader header;
+      read(f, &header, 1, path);
+      if (::std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+          || header.boardSz != sizeof(board_t) || header.commDataSz != sizeof(comm_data_t)
+          || header.estimateSz != sizeof(estimate_t))
+      {
+        ::std::cerr << "ERROR: not a checkpoint of this build: " << path << ::std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+
+      ::std::uint64_t n;
+      for (auto* set : { &wins, &losses })
+      {
+        read(f, &n, 1, path);
+        for (::std::uint64_t i = 0; i < n; ++i)
+        {
+          board_t b;
+          read(f, &b, 1, path);
+          if (p(b) == m_id)
+            set->insert(b);
+        }
+      }
+      read(f, &n, 1, path);
+      for (::std::uint64_t i = 0; i < n; ++i)
+      {
+        board_t b;
+        estimate_t estimate;
+        read(f, &b, 1, path);
+        read(f, &estimate, 1, path);
+        if (p(b) == m_id)
+          estimateData[b] = estimate;
+      }
+      read(f, &n, 1, path);
+      for (::std::uint64_t i = 0; i < n; ++i)
+      {
+        comm_data_t commData;
+        read(f, &commData, 1, path);
+        if (p(commData.b) == m_id)
+          frontier.insert(commData);
+      }
+      ::std::fclose(f);
+    }
+
+    // the next checkpoint must not overwrite the shards just read, which other ranks may still be reading
+    m_seq = m.seq;
+    m_seqNumProcs = m.numProcs;
+    return { static_cast<short>(m.v), m.afterMajor != 0 };
+  }
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Tablebase written by all cluster ranks into one shared file. Each rank writes the slice of positions the
+ * partitioner assigned it with collective MPI-IO writes, so the output scales with the number of ranks rather
+ * than funnelling through rank 0. The file is laid out as
+ *   a FileHeader, which names the partitioner and the pieceset
+ *   one PartHeader per rank, with the offset of its slice and the number of wins and losses it holds
+ *   the slices of ranks 0, 1, ... in order
+ * A slice holds its wins, then its losses, each as the raw board followed by its depth as a 16 bit integer.
+ * A position is found in the slice of the rank that the same partitioner assigns it to.
+ */
+
+#ifndef CLUSTER_TABLEBASE_HPP_
+#define CLUSTER_TABLEBASE_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+#include "piece_label.hpp"
+
+// Bytes a rank writes per collective call. Override at compile time to tune
+#ifndef CLUSTER_TABLEBASE_WRITE_SZ
+#  define CLUSTER_TABLEBASE_WRITE_SZ (64 << 20)
+#endif
+
+class ClusterTablebase
+{
+public:
+  struct FileHeader
+  {
+    char magic[8];
+    ::std::uint32_t version;
+    ::std::uint32_t boardSz;
+    ::std::uint32_t recordSz;
+    ::std::int32_t numParts;
+    char partitioner[16];
+    ::std::uint32_t piecesetSz;
+    piece_label_t pieceset[32];
+  };
+
+  struct PartHeader
+  {
+    ::std::uint64_t offset;
+    ::std::uint64_t numWins;
+    ::std::uint64_t numLosses;
+  };
+
+private:
+  static constexpr char MAGIC[8] = { 'S', 'C', 'R', 'A', 'P', 'C', 'T', 'B' };
+  static constexpr ::std::uint32_t VERSION = 1;
+
+  // an I/O failure on one rank would leave the others blocked in the next collective
+  static void check(int err, const char* what, const ::std::string& path)
+  {
+    if (err == MPI_SUCCESS)
+      return;
+    char msg[MPI_MAX_ERROR_STRING];
+    int len = 0;
+    MPI_Error_string(err, msg, &len);
+    ::std::cerr << "ERROR: tablebase " << what << " " << path << ": " << ::std::string(msg, len) << ::std::endl;
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  template <typename T>
+  static void append(const T& x, ::std::vector<unsigned char>& out)
+  {
+    static_assert(::std::is_trivially_copyable_v<T>, "tablebases hold raw bytes");
+    auto bytes = reinterpret_cast<const unsigned char*>(&x);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+  }
+
+public:
+  /*
+   * Writes the wins and losses of every rank to path, with the depths of estimateData (0 for boards it does not
+   * hold, such as checkmates). Must be called by all ranks. partitioner names how boards were assigned to ranks.
+   */
+  template <typename BoardSet, typename BoardMap>
+  static void write(const ::std::string& path, int id, int numProcs, const char* partitioner,
+      const ::std::vector<piece_label_t>& pieceset, const BoardSet& wins, const BoardSet& losses,
+      const BoardMap& estimateData)
+  {
+    using board_t = typename BoardSet::value_type;
+    constexpr ::std::size_t recordSz = sizeof(board_t) + sizeof(::std::int16_t);
+
+    // every rank learns the size of every slice, and with it where its own slice starts
+    ::std::uint64_t counts[2] = { wins.size(), losses.size() };
+    ::std::vector<::std::uint64_t> allCounts(2 * numProcs);
+    MPI_Allgather(counts, 2, MPI_UINT64_T, allCounts.data(), 2, MPI_UINT64_T, MPI_COMM_WORLD);
+
+    ::std::vector<PartHeader> parts(numProcs);
+    ::std::uint64_t fileSz = sizeof(FileHeader) + numProcs * sizeof(PartHeader);
+    for (int rank = 0; rank < numProcs; ++rank)
+    {
+      parts[rank] = { fileSz, allCounts[2 * rank], allCounts[2 * rank + 1] };
+      fileSz += (parts[rank].numWins + parts[rank].numLosses) * recordSz;
+    }
+
+    MPI_File f;
+    check(MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &f),
+        "open", path);
+    // a longer file left by an earlier run would otherwise keep its tail
+    check(MPI_File_set_size(f, static_cast<MPI_Offset>(fileSz)), "resize", path);
+
+    ::std::vector<unsigned char> buffer;
+    MPI_Offset pos = static_cast<MPI_Offset>(parts[id].offset);
+    // rank 0 writes the headers in front of its slice
+    if (id == 0)
+    {
+      FileHeader header{};
+      ::std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+      header.version = VERSION;
+      header.boardSz = sizeof(board_t);
+      header.recordSz = recordSz;
+      header.numParts = numProcs;
+      ::std::strncpy(header.partitioner, partitioner, sizeof(header.partitioner) - 1);
+      if (pieceset.size() > sizeof(header.pieceset))
+      {
+        ::std::cerr << "ERROR: tablebase " << path << ": pieceset too large for the header" << ::std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      header.piecesetSz = static_cast<::std::uint32_t>(pieceset.size());
+      ::std::copy(pieceset.begin(), pieceset.end(), header.pieceset);
+      append(header, buffer);
+      for (const auto& part : parts)
+        append(part, buffer);
+      pos = 0;
+    }
+
+    // the writes are collective, so every rank takes part in rounds until no rank has records left
+    auto winIt = wins.begin();
+    auto lossIt = losses.begin();
+    auto b_localPending = [&]() { return winIt != wins.end() || lossIt != losses.end(); };
+    bool b_pending = true;
+    while (b_pending)
+    {
+      while (buffer.size() + recordSz <= CLUSTER_TABLEBASE_WRITE_SZ && b_localPending())
+      {
+        const auto& b = winIt != wins.end() ? *winIt++ : *lossIt++;
+        auto it = estimateData.find(b);
+        ::std::int16_t depth = it == estimateData.end() ? 0 : it->second.T;
+        append(b, buffer);
+        append(depth, buffer);
+      }
+      MPI_Status status;
+      check(MPI_File_write_at_all(f, pos, buffer.data(), static_cast<int>(buffer.size()), MPI_BYTE, &status),
+          "write", path);
+      pos += static_cast<MPI_Offset>(buffer.size());
+      buffer.clear();
+
+      bool b_more = b_localPending();
+      MPI_Allreduce(&b_more, &b_pending, 1, MPI_C_BOOL, MPI_LOR, MPI_COMM_WORLD);
+    }
+    check(MPI_File_close(&f), "close", path);
+  }
+
+  /*
+   * Reads the headers of the tablebase at path into header and parts. Returns false if the file is missing or
+   * is not a tablebase
+   */
+  static bool readHeaders(const ::std::string& path, FileHeader& header, ::std::vector<PartHeader>& parts)
+  {
+    ::std::FILE* f = ::std::fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+    bool ok = ::std::fread(&header, sizeof(header), 1, f) == 1
+      && ::std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION
+      && header.numParts > 0;
+    if (ok)
+    {
+      parts.resize(header.numParts);
+      ok = ::std::fread(parts.data(), sizeof(PartHeader), parts.size(), f) == parts.size();
+    }
+    ::std::fclose(f);
+    return ok;
+  }
+
+  // reads the wins and losses that rank part wrote, with their depths. Returns false on a read error
+  template <typename Board>
+  static bool readSlice(const ::std::string& path, int part, ::std::vector<::std::pair<Board, short>>& wins,
+      ::std::vector<::std::pair<Board, short>>& losses)
+  {
+    FileHeader header;
+    ::std::vector<PartHeader> parts;
+    if (!readHeaders(path, header, parts) || header.boardSz != sizeof(Board) || part < 0 || part >= header.numParts)
+      return false;
+    ::std::FILE* f = ::std::fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+    bool ok = ::std::fseek(f, static_cast<long>(parts[part].offset), SEEK_SET) == 0;
+    for (auto [results, n] : { ::std::make_pair(&wins, parts[part].numWins),
+        ::std::make_pair(&losses, parts[part].numLosses) })
+    {
+      for (::std::uint64_t i = 0; ok && i < n; ++i)
+      {
+        Board b;
+        ::std::int16_t depth;
+        ok = ::std::fread(&b, sizeof(b), 1, f) == 1 && ::std::fread(&depth, sizeof(depth), 1, f) == 1;
+        if (ok)
+          results->emplace_back(b, depth);
+      }
+    }
+    ::std::fclose(f);
+    return ok;
+  }
+};
+
+#endif
@@ -0,0 +1,643 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The communication used by the cluster solver, with two backends. MpiTransport forwards to MPI_COMM_WORLD.
+ * InProcessTransport emulates the ranks of a cluster as threads of one process, so the distributed algorithm
+ * can be run, measured and tested without an MPI launcher. Both offer the same members, and the solver is
+ * templated on the one it is given.
+ */
+
+#ifndef CLUSTER_TRANSPORT_HPP_
+#define CLUSTER_TRANSPORT_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <mpi.h>
+
+// MPI datatype of the elements of a message. Specialized next to the structs that the solver sends
+template <typename T>
+struct mpi_datatype;
+
+template <>
+struct mpi_datatype<unsigned char>
+{
+  static MPI_Datatype get(void) { return MPI_BYTE; }
+};
+
+template <>
+struct mpi_datatype<int>
+{
+  static MPI_Datatype get(void) { return MPI_INT; }
+};
+
+/*
+ * Messages go to or come from any rank of MPI_COMM_WORLD. A status describes a probed message, which recv
+ * must then receive before the next probe. Requests that complete are set to nullRequest.
+ */
+class MpiTransport
+{
+public:
+  using request_t = MPI_Request;
+  using status_t = MPI_Status;
+
+  static request_t nullRequest(void) { return MPI_REQUEST_NULL; }
+
+  int rank(void) const
+  {
+    int rank = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+  }
+
+  int size(void) const
+  {
+    int size = 0;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    return size;
+  }
+
+  template <typename T>
+  void isend(const T* data, int count, int target, int tag, request_t* r)
+  {
+    MPI_Isend(data, count, mpi_datatype<T>::get(), target, tag, MPI_COMM_WORLD, r);
+  }
+
+  // completes only once the receiver has matched the message
+  template <typename T>
+  void issend(const T* data, int count, int target, int tag, request_t* r)
+  {
+    MPI_Issend(data, count, mpi_datatype<T>::get(), target, tag, MPI_COMM_WORLD, r);
+  }
+
+  // waits for a message of any tag from any rank
+  void probe(status_t& status)
+  {
+    MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+  }
+
+  bool iprobe(int tag, status_t& status)
+  {
+    int b_arrived = 0;
+    MPI_Iprobe(MPI_ANY_SOURCE, tag, MPI_COMM_WORLD, &b_arrived, &status);
+    return b_arrived != 0;
+  }
+
+  static int source(const status_t& status) { return status.MPI_SOURCE; }
+
+  static int tag(const status_t& status) { return status.MPI_TAG; }
+
+  template <typename T>
+  int count(const status_t& status) const
+  {
+    int count = 0;
+    MPI_Get_count(&status, mpi_datatype<T>::get(), &count);
+    return count;
+  }
+
+  template <typename T>
+  void recv(T* data, int count, const status_t& status)
+  {
+    MPI_Recv(data, count, mpi_datatype<T>::get(), status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD,
+        MPI_STATUS_IGNORE);
+  }
+
+  // stores the positions of the requests that completed in completed, and returns their number
+  int testsome(::std::vector<request_t>& requests, int* completed)
+  {
+    int numCompleted = 0;
+    MPI_Testsome(static_cast<int>(requests.size()), requests.data(), &numCompleted, completed, MPI_STATUSES_IGNORE);
+    return numCompleted == MPI_UNDEFINED ? 0 : numCompleted;
+  }
+
+  void waitall(::std::vector<request_t>& requests)
+  {
+    MPI_Waitall(static_cast<int>(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+  }
+
+  bool testall(::std::vector<request_t>& requests)
+  {
+    int b_complete = 0;
+    MPI_Testall(static_cast<int>(requests.size()), requests.data(), &b_complete, MPI_STATUSES_IGNORE);
+    return b_complete != 0;
+  }
+
+  bool test(request_t& r)
+  {
+    int b_complete = 0;
+    MPI_Test(&r, &b_complete, MPI_STATUS_IGNORE);
+    return b_complete != 0;
+  }
+
+  void barrier(void) { MPI_Barrier(MPI_COMM_WORLD); }
+
+  bool allreduceOr(bool b_local)
+  {
+    bool b_any = false;
+    MPI_Allreduce(&b_local, &b_any, 1, MPI_C_BOOL, MPI_LOR, MPI_COMM_WORLD);
+    return b_any;
+  }
+
+  // both flags must stay valid until r completes
+  void iallreduceOr(const bool* b_local, bool* b_any, request_t* r)
+  {
+    MPI_Iallreduce(b_local, b_any, 1, MPI_C_BOOL, MPI_LOR, MPI_COMM_WORLD, r);
+  }
+
+  // trades one int with every rank
+  void alltoall(const int* sendCounts, int* recvCounts)
+  {
+    MPI_Alltoall(sendCounts, 1, MPI_INT, recvCounts, 1, MPI_INT, MPI_COMM_WORLD);
+  }
+
+  template <typename T>
+  void alltoallv(const T* sendData, const int* sendCounts, const int* sendDispls,
+      T* recvData, const int* recvCounts, const int* recvDispls)
+  {
+    MPI_Alltoallv(sendData, sendCounts, sendDispls, mpi_datatype<T>::get(),
+        recvData, recvCounts, recvDispls, mpi_datatype<T>::get(), MPI_COMM_WORLD);
+  }
+
+  // a counter shared by all ranks, which rank 0 exposes in an MPI window
+  struct counter_t
+  {
+    MPI_Win win = MPI_WIN_NULL;
+    ::std::int64_t* value = nullptr;
+  };
+
+  // creates a counter that starts at 0. Collective
+  counter_t createCounter(void)
+  {
+    counter_t c;
+    bool b_owner = rank() == 0;
+    MPI_Win_allocate(b_owner ? sizeof(::std::int64_t) : 0, sizeof(::std::int64_t), MPI_INFO_NULL,
+        MPI_COMM_WORLD, &c.value, &c.win);
+    if (b_owner)
+    {
+      MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, c.win);
+      *c.value = 0;
+      MPI_Win_unlock(0, c.win);
+    }
+    // no rank may add to the counter before it is set
+    barrier();
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, c.win);
+    return c;
+  }
+
+  // atomically adds n to the counter and returns its previous value
+  ::std::int64_t fetchAdd(counter_t& c, ::std::int64_t n)
+  {
+    ::std::int64_t prev = 0;
+    MPI_Fetch_and_op(&n, &prev, MPI_INT64_T, 0, 0, MPI_SUM, c.win);
+    MPI_Win_flush(0, c.win);
+    return prev;
+  }
+
+  // collective
+  void freeCounter(counter_t& c)
+  {
+    MPI_Win_unlock_all(c.win);
+    MPI_Win_free(&c.win);
+  }
+};
+
+/*
+ * State shared by the ranks of an in-process cluster. Every rank has an inbox that any rank pushes messages
+ * onto without locking, and that only its owner empties, taking all of it at once. Collectives are rare, at
+ * most a few per iteration, so their state sits behind one mutex. Each one is identified by how many
+ * collectives its ranks have joined before it, which is the same on every rank as with MPI.
+ */
+class InProcessCluster
+{
+public:
+  struct Message
+  {
+    Message* next;
+    int source;
+    int tag;
+    ::std::vector<unsigned char> bytes;
+    // set once the message is received, for synchronous sends
+    ::std::shared_ptr<::std::atomic<bool>> matched;
+  };
+
+private:
+  struct alignas(64) Inbox
+  {
+    ::std::atomic<Message*> head{ nullptr };
+  };
+
+  struct Collective
+  {
+    int arrived = 0;
+    int left = 0;
+    bool b_any = false;
+    // per rank arguments of an all-to-all
+    ::std::vector<const unsigned char*> data;
+    ::std::vector<const int*> counts;
+    ::std::vector<const int*> displs;
+  };
+
+  int m_numRanks;
+  ::std::unique_ptr<Inbox[]> m_inboxes;
+  ::std::mutex m_mutex;
+  ::std::condition_variable m_arrival;
+  ::std::map<long, Collective> m_collectives;
+  // shared counters, in the order the ranks created them. A deque never moves its elements
+  ::std::deque<::std::atomic<::std::int64_t>> m_counters;
+
+  Collective& collective(long seq)
+  {
+    auto& c = m_collectives[seq];
+    if (c.data.empty())
+    {
+      c.data.resize(m_numRanks);
+      c.counts.resize(m_numRanks);
+      c.displs.resize(m_numRanks);
+    }
+    return c;
+  }
+
+  void leave(long seq, Collective& c)
+  {
+    if (++c.left == m_numRanks)
+      m_collectives.erase(seq);
+  }
+
+public:
+  explicit InProcessCluster(int numRanks)
+    : m_numRanks(numRanks), m_inboxes(new Inbox[numRanks])
+  {
+    assert(numRanks > 0);
+  }
+
+  InProcessCluster(const InProcessCluster&) = delete;
+  InProcessCluster& operator=(const InProcessCluster&) = delete;
+
+  ~InProcessCluster()
+  {
+    for (int i = 0; i < m_numRanks; ++i)
+    {
+      for (auto* msg = m_inboxes[i].head.load(); msg; )
+      {
+        auto* next = msg->next;
+        delete msg;
+        msg = next;
+      }
+    }
+  }
+
+  int size(void) const { return m_numRanks; }
+
+  void push(int target, Message* msg)
+  {
+    auto& head = m_inboxes[target].head;
+    msg->next = head.load(::std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(msg->next, msg, ::std::memory_order_release, ::std::memory_order_relaxed))
+      ;
+    // wakes the owner if it blocks in waitFor
+    if (!msg->next)
+      head.notify_one();
+  }
+
+  // returns the messages sent to rank since the last call, most recent first
+  Message* takeAll(int rank)
+  {
+    return m_inboxes[rank].head.exchange(nullptr, ::std::memory_order_acquire);
+  }
+
+  // blocks until a message is sent to rank
+  void waitFor(int rank)
+  {
+    m_inboxes[rank].head.wait(nullptr, ::std::memory_order_acquire);
+  }
+
+  void arriveOr(long seq, bool b_local)
+  {
+    ::std::lock_guard<::std::mutex> lock(m_mutex);
+    auto& c = collective(seq);
+    c.b_any = c.b_any || b_local;
+    if (++c.arrived == m_numRanks)
+      m_arrival.notify_all();
+  }
+
+  // whether every rank has arrived at collective seq, in which case b_any is set to its result
+  bool pollOr(long seq, bool& b_any)
+  {
+    ::std::lock_guard<::std::mutex> lock(m_mutex);
+    auto& c = collective(seq);
+    if (c.arrived != m_numRanks)
+      return false;
+    b_any = c.b_any;
+    leave(seq, c);
+    return true;
+  }
+
+  bool waitOr(long seq)
+  {
+    ::std::unique_lock<::std::mutex> lock(m_mutex);
+    m_arrival.wait(lock, [&]() { return collective(seq).arrived == m_numRanks; });
+    auto& c = collective(seq);
+    bool b_any = c.b_any;
+    leave(seq, c);
+    return b_any;
+  }
+
+  // the id-th counter created, which starts at 0
+  ::std::atomic<::std::int64_t>& counter(::std::size_t id)
+  {
+    ::std::lock_guard<::std::mutex> lock(m_mutex);
+    while (m_counters.size() <= id)
+      m_counters.emplace_back(0);
+    return m_counters[id];
+  }
+
+  // copies what every rank sends to rank into recvData. The send buffers are only read until every rank
+  // has copied, which the caller must wait for with another collective before changing them
+  void alltoallv(long seq, int rank, ::std::size_t elementSz, const unsigned char* sendData, const int* sendCounts,
+      const int* sendDispls, unsigned char* recvData, const int* recvDispls)
+  {
+    ::std::unique_lock<::std::mutex> lock(m_mutex);
+    auto& c = collective(seq);
+    c.data[rank] = sendData;
+    c.counts[rank] = sendCounts;
+    c.displs[rank] = sendDispls;
+    if (++c.arrived == m_numRanks)
+      m_arrival.notify_all();
+    m_arrival.wait(lock, [&]() { return c.arrived == m_numRanks; });
+    for (int source = 0; source < m_numRanks; ++source)
+    {
+      ::std::memcpy(recvData + recvDispls[source] * elementSz,
+          c.data[source] + c.displs[source][rank] * elementSz, c.counts[source][rank] * elementSz);
+    }
+    leave(seq, c);
+  }
+};
+
+/*
+ * One rank of an InProcessCluster. Sends copy the message, so they complete at once unless they are
+ * synchronous. Messages are taken from the inbox into a private list in the order each rank sent them, which
+ * keeps the non-overtaking guarantee of MPI between any two ranks.
+ */
+class InProcessTransport
+{
+public:
+  struct request_t
+  {
+    // set once a send completes
+    ::std::shared_ptr<::std::atomic<bool>> b_complete;
+    // collective of a non-blocking reduction, and where its result goes
+    long seq = -1;
+    bool* b_any = nullptr;
+  };
+
+  // stays valid after the message is received, as an MPI status does
+  struct status_t
+  {
+    InProcessCluster::Message* msg;
+    int source;
+    int tag;
+  };
+
+private:
+  InProcessCluster* m_cluster;
+  int m_rank;
+  long m_seq = 0;
+  ::std::size_t m_numCounters = 0;
+  ::std::vector<InProcessCluster::Message*> m_pending;
+
+  void drain(void)
+  {
+    auto* msg = m_cluster->takeAll(m_rank);
+    auto first = m_pending.size();
+    for (; msg; msg = msg->next)
+      m_pending.push_back(msg);
+    ::std::reverse(m_pending.begin() + first, m_pending.end());
+  }
+
+  template <typename T>
+  void send(const T* data, int count, int target, int tag, ::std::shared_ptr<::std::atomic<bool>> matched)
+  {
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    m_cluster->push(target, new InProcessCluster::Message{ nullptr, m_rank, tag,
+        ::std::vector<unsigned char>(bytes, bytes + count * sizeof(T)), ::std::move(matched) });
+  }
+
+  bool complete(request_t& r)
+  {
+    if (r.b_complete)
+      return r.b_complete->load(::std::memory_order_acquire);
+    if (r.seq >= 0)
+      return m_cluster->pollOr(r.seq, *r.b_any);
+    return true;
+  }
+
+public:
+  InProcessTransport(InProcessCluster& cluster, int rank)
+    : m_cluster(&cluster), m_rank(rank)
+  {
+  }
+
+  InProcessTransport(const InProcessTransport&) = delete;
+  InProcessTransport& operator=(const InProcessTransport&) = delete;
+
+  ~InProcessTransport()
+  {
+    for (auto* msg : m_pending)
+      delete msg;
+  }
+
+  static request_t nullRequest(void) { return {}; }
+
+  int rank(void) const { return m_rank; }
+
+  int size(void) const { return m_cluster->size(); }
+
+  template <typename T>
+  void isend(const T* data, int count, int target, int tag, request_t* r)
+  {
+    // shared by every buffered send, which completes as soon as it is copied
+    static const auto sent = ::std::make_shared<::std::atomic<bool>>(true);
+    send(data, count, target, tag, nullptr);
+    *r = { sent };
+  }
+
+  template <typename T>
+  void issend(const T* data, int count, int target, int tag, request_t* r)
+  {
+    auto matched = ::std::make_shared<::std::atomic<bool>>(false);
+    send(data, count, target, tag, matched);
+    *r = { ::std::move(matched) };
+  }
+
+  void probe(status_t& status)
+  {
+    while (true)
+    {
+      drain();
+      if (!m_pending.empty())
+      {
+        auto* msg = m_pending.front();
+        status = { msg, msg->source, msg->tag };
+        return;
+      }
+      m_cluster->waitFor(m_rank);
+    }
+  }
+
+  bool iprobe(int tag, status_t& status)
+  {
+    drain();
+    auto it = ::std::find_if(m_pending.begin(), m_pending.end(),
+        [tag](const InProcessCluster::Message* msg) { return msg->tag == tag; });
+    if (it == m_pending.end())
+      return false;
+    status = { *it, (*it)->source, (*it)->tag };
+    return true;
+  }
+
+  static int source(const status_t& status) { return status.source; }
+
+  static int tag(const status_t& status) { return status.tag; }
+
+  template <typename T>
+  int count(const status_t& status) const { return static_cast<int>(status.msg->bytes.size() / sizeof(T)); }
+
+  template <typename T>
+  void recv(T* data, int count, const status_t& status)
+  {
+    auto* msg = status.msg;
+    assert(count * sizeof(T) == msg->bytes.size());
+    ::std::memcpy(data, msg->bytes.data(), msg->bytes.size());
+    if (msg->matched)
+      msg->matched->store(true, ::std::memory_order_release);
+    m_pending.erase(::std::find(m_pending.begin(), m_pending.end(), msg));
+    delete msg;
+  }
+
+  int testsome(::std::vector<request_t>& requests, int* completed)
+  {
+    int numCompleted = 0;
+    for (int i = 0; i < static_cast<int>(requests.size()); ++i)
+    {
+      auto& r = requests[i];
+      if ((r.b_complete || r.seq >= 0) && complete(r))
+      {
+        r = nullRequest();
+        completed[numCompleted++] = i;
+      }
+    }
+    return numCompleted;
+  }
+
+  void waitall(::std::vector<request_t>& requests)
+  {
+    while (!testall(requests))
+      ::std::this_thread::yield();
+  }
+
+  bool testall(::std::vector<request_t>& requests)
+  {
+    for (auto& r : requests)
+    {
+      if (!complete(r))
+        return false;
+    }
+    for (auto& r : requests)
+      r = nullRequest();
+    return true;
+  }
+
+  bool test(request_t& r)
+  {
+    if (!complete(r))
+      return false;
+    r = nullRequest();
+    return true;
+  }
+
+  void barrier(void) { allreduceOr(false); }
+
+  bool allreduceOr(bool b_local)
+  {
+    m_cluster->arriveOr(m_seq, b_local);
+    return m_cluster->waitOr(m_seq++);
+  }
+
+  void iallreduceOr(const bool* b_local, bool* b_any, request_t* r)
+  {
+    m_cluster->arriveOr(m_seq, *b_local);
+    *r = { nullptr, m_seq++, b_any };
+  }
+
+  void alltoall(const int* sendCounts, int* recvCounts)
+  {
+    ::std::vector<int> ones(size(), 1);
+    ::std::vector<int> displs(size());
+    for (int i = 0; i < size(); ++i)
+      displs[i] = i;
+    alltoallv(sendCounts, ones.data(), displs.data(), recvCounts, ones.data(), displs.data());
+  }
+
+  template <typename T>
+  void alltoallv(const T* sendData, const int* sendCounts, const int* sendDispls,
+      T* recvData, [[maybe_unused]] const int* recvCounts, const int* recvDispls)
+  {
+    m_cluster->alltoallv(m_seq++, m_rank, sizeof(T), reinterpret_cast<const unsigned char*>(sendData),
+        sendCounts, sendDispls, reinterpret_cast<unsigned char*>(recvData), recvDispls);
+    // the other ranks may still be copying from sendData
+    barrier();
+  }
+
+  using counter_t = ::std::atomic<::std::int64_t>*;
+
+  // the ranks create their counters in the same order, so the n-th of each rank is the same counter
+  counter_t createCounter(void) { return &m_cluster->counter(m_numCounters++); }
+
+  ::std::int64_t fetchAdd(counter_t& c, ::std::int64_t n) { return c->fetch_add(n); }
+
+  // the cluster keeps its counters until it is destroyed
+  void freeCounter(counter_t&) {}
+};
+
+// runs fn(transport) for every rank of a cluster of numRanks threads, and returns once all have
+template <typename Fn>
+void runInProcessCluster(int numRanks, Fn fn)
+{
+  InProcessCluster cluster(numRanks);
+  ::std::vector<::std::thread> ranks;
+  for (int i = 0; i < numRanks; ++i)
+  {
+    ranks.emplace_back([&cluster, &fn, i]()
+    {
+      InProcessTransport transport(cluster, i);
+      fn(transport);
+    });
+  }
+  for (auto& rank : ranks)
+    rank.join();
+}
+
+#endif
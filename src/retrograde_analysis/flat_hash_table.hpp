@@ -0,0 +1,492 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Open addressing hash set and map used for the board sets, frontiers and estimate data of the solvers.
+ * Elements are stored inline in one slot array next to an array of control bytes (empty, deleted or 7 bits
+ * of the hash), in the style of Swiss tables. A lookup compares a group of 16 control bytes at once (with
+ * SSE2 when available) and only touches the slots whose control byte matches.
+ *
+ * The interface follows std::unordered_set / std::unordered_map closely enough for the solvers, including
+ * the bucket interface used to split iteration across OpenMP threads: every slot is a bucket holding zero
+ * or one element. Unlike the node based containers, inserting may move elements, so pointers and
+ * iterators into the table are invalidated by any insertion.
+ */
+
+#ifndef FLAT_HASH_TABLE_HPP_
+#define FLAT_HASH_TABLE_HPP_
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// key extraction for sets and maps
+struct FlatSetPolicy
+{
+  template <typename Value>
+  static const Value& key(const Value& v) { return v; }
+};
+
+struct FlatMapPolicy
+{
+  template <typename Value>
+  static const auto& key(const Value& v) { return v.first; }
+};
+
+template <typename Key, typename Value, typename Policy, typename Hash, typename KeyEqual>
+class FlatHashTable
+{
+  using ctrl_t = ::std::int8_t;
+
+  static constexpr ctrl_t CTRL_EMPTY = -128;   // 0b10000000
+  static constexpr ctrl_t CTRL_DELETED = -2;   // 0b11111110
+  static constexpr ::std::size_t GROUP_SZ = 16;
+
+  static bool isFull(ctrl_t c) { return c >= 0; }
+
+  // bit i is set if control byte i of the group equals c
+  static ::std::uint32_t matchGroup(const ctrl_t* group, ctrl_t c)
+  {
+#ifdef __SSE2__
+    auto g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<::std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c))));
+#else
+    ::std::uint32_t mask = 0;
+    for (::std::size_t i = 0; i < GROUP_SZ; ++i)
+      mask |= static_cast<::std::uint32_t>(group[i] == c) << i;
+    return mask;
+#endif
+  }
+
+  // bit i is set if control byte i of the group is empty or deleted
+  static ::std::uint32_t matchNotFull(const ctrl_t* group)
+  {
+#ifdef __SSE2__
+    auto g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<::std::uint32_t>(_mm_movemask_epi8(g));
+#else
+    ::std::uint32_t mask = 0;
+    for (::std::size_t i = 0; i < GROUP_SZ; ++i)
+      mask |= static_cast<::std::uint32_t>(!isFull(group[i])) << i;
+    return mask;
+#endif
+  }
+
+  // spreads the user hash so that both the group index and the 7 stored bits are well distributed
+  static ::std::uint64_t mixHash(::std::uint64_t h)
+  {
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 32);
+  }
+
+public:
+  using key_type = Key;
+  using value_type = Value;
+  using size_type = ::std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+  using policy_type = Policy;
+
+private:
+  // slots are allocated uninitialized and only full slots hold a constructed value
+  ::std::unique_ptr<ctrl_t[]> m_ctrl;
+  value_type* m_slots = nullptr;
+  size_type m_capacity = 0;
+  size_type m_size = 0;
+  size_type m_growthLeft = 0;
+  [[no_unique_address]] Hash m_hash;
+  [[no_unique_address]] KeyEqual m_eq;
+
+  static size_type maxLoad(size_type capacity) { return capacity - capacity / 8; }
+
+  value_type* allocateSlots(size_type n) { return ::std::allocator<value_type>{}.allocate(n); }
+
+  void deallocateSlots(value_type* slots, size_type n)
+  {
+    if (slots)
+      ::std::allocator<value_type>{}.deallocate(slots, n);
+  }
+
+  void destroyAll()
+  {
+    if constexpr (!::std::is_trivially_destructible_v<value_type>)
+      for (size_type i = 0; i < m_capacity; ++i)
+        if (isFull(m_ctrl[i]))
+          ::std::destroy_at(m_slots + i);
+  }
+
+  void release()
+  {
+    destroyAll();
+    deallocateSlots(m_slots, m_capacity);
+    m_ctrl.reset();
+    m_slots = nullptr;
+    m_capacity = m_size = m_growthLeft = 0;
+  }
+
+  // capacity is a power of two number of groups
+  void allocate(size_type capacity)
+  {
+    m_capacity = capacity;
+    m_ctrl.reset(new ctrl_t[capacity]);
+    ::std::memset(m_ctrl.get(), CTRL_EMPTY, capacity);
+    m_slots = allocateSlots(capacity);
+    m_size = 0;
+    m_growthLeft = maxLoad(capacity);
+  }
+
+  size_type groupMask() const { return m_capacity / GROUP_SZ - 1; }
+
+  // first slot of the probe sequence that is empty or deleted
+  size_type findInsertSlot(::std::uint64_t h) const
+  {
+    size_type group = (h >> 7) & groupMask();
+    for (size_type step = 1; ; ++step)
+    {
+      auto free = matchNotFull(m_ctrl.get() + group * GROUP_SZ);
+      if (free)
+        return group * GROUP_SZ + ::std::countr_zero(free);
+      group = (group + step) & groupMask();
+    }
+  }
+
+  void resize(size_type capacity)
+  {
+    auto oldCtrl = ::std::move(m_ctrl);
+    auto oldSlots = m_slots;
+    auto oldCapacity = m_capacity;
+    allocate(capacity);
+
+    for (size_type i = 0; i < oldCapacity; ++i)
+    {
+      if (!isFull(oldCtrl[i]))
+        continue;
+      auto h = mixHash(m_hash(Policy::key(oldSlots[i])));
+      auto slot = findInsertSlot(h);
+      m_ctrl[slot] = static_cast<ctrl_t>(h & 0x7F);
+      ::std::construct_at(m_slots + slot, ::std::move(oldSlots[i]));
+      ::std::destroy_at(oldSlots + i);
+      ++m_size;
+    }
+    m_growthLeft = maxLoad(m_capacity) - m_size;
+    deallocateSlots(oldSlots, oldCapacity);
+  }
+
+  void growIfFull()
+  {
+    if (m_growthLeft > 0)
+      return;
+    // reclaim deleted slots if they make up a large part of the table instead of growing
+    if (m_capacity && m_size <= maxLoad(m_capacity) / 2)
+      resize(m_capacity);
+    else
+      resize(m_capacity ? 2 * m_capacity : GROUP_SZ);
+  }
+
+  size_type findSlot(const key_type& key, ::std::uint64_t h) const
+  {
+    if (!m_capacity)
+      return m_capacity;
+    auto tag = static_cast<ctrl_t>(h & 0x7F);
+    size_type group = (h >> 7) & groupMask();
+    for (size_type step = 1; ; ++step)
+    {
+      const ctrl_t* ctrl = m_ctrl.get() + group * GROUP_SZ;
+      for (auto match = matchGroup(ctrl, tag); match; match &= match - 1)
+      {
+        auto slot = group * GROUP_SZ + ::std::countr_zero(match);
+        if (m_eq(Policy::key(m_slots[slot]), key))
+          return slot;
+      }
+      // an empty control byte ends the probe sequence
+      if (matchGroup(ctrl, CTRL_EMPTY))
+        return m_capacity;
+      group = (group + step) & groupMask();
+    }
+  }
+
+  template <bool IsConst>
+  class Iterator
+  {
+    friend class FlatHashTable;
+    using table_ptr = ::std::conditional_t<IsConst, const FlatHashTable*, FlatHashTable*>;
+
+    table_ptr m_table;
+    size_type m_slot;
+
+    void skipEmpty()
+    {
+      while (m_slot < m_table->m_capacity && !isFull(m_table->m_ctrl[m_slot]))
+        ++m_slot;
+    }
+
+  public:
+    using iterator_category = ::std::forward_iterator_tag;
+    using value_type = Value;
+    using difference_type = ::std::ptrdiff_t;
+    using pointer = ::std::conditional_t<IsConst, const Value*, Value*>;
+    using reference = ::std::conditional_t<IsConst, const Value&, Value&>;
+
+    Iterator() : m_table(nullptr), m_slot(0) {}
+    Iterator(table_ptr table, size_type slot) : m_table(table), m_slot(slot) {}
+
+    template <bool OtherConst, typename = ::std::enable_if_t<IsConst && !OtherConst>>
+    Iterator(const Iterator<OtherConst>& other) : m_table(other.m_table), m_slot(other.m_slot) {}
+
+    reference operator*() const { return m_table->m_slots[m_slot]; }
+    pointer operator->() const { return m_table->m_slots + m_slot; }
+
+    Iterator& operator++()
+    {
+      ++m_slot;
+      skipEmpty();
+      return *this;
+    }
+
+    Iterator operator++(int)
+    {
+      auto prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    bool operator==(const Iterator& other) const { return m_slot == other.m_slot; }
+    bool operator!=(const Iterator& other) const { return m_slot != other.m_slot; }
+
+    template <bool> friend class Iterator;
+  };
+
+  // elements of a set may not be modified through an iterator
+  static constexpr bool IS_SET = ::std::is_same_v<Policy, FlatSetPolicy>;
+
+public:
+  using const_iterator = Iterator<true>;
+  using iterator = ::std::conditional_t<IS_SET, const_iterator, Iterator<false>>;
+  using local_iterator = ::std::conditional_t<IS_SET, const value_type*, value_type*>;
+  using const_local_iterator = const value_type*;
+
+  FlatHashTable() = default;
+
+  template <typename InputIt>
+  FlatHashTable(InputIt first, InputIt last)
+  {
+    insert(first, last);
+  }
+
+  FlatHashTable(const FlatHashTable& other)
+    : m_hash(other.m_hash), m_eq(other.m_eq)
+  {
+    if (!other.m_capacity)
+      return;
+    allocate(other.m_capacity);
+    ::std::memcpy(m_ctrl.get(), other.m_ctrl.get(), m_capacity);
+    for (size_type i = 0; i < m_capacity; ++i)
+      if (isFull(m_ctrl[i]))
+        ::std::construct_at(m_slots + i, other.m_slots[i]);
+    m_size = other.m_size;
+    m_growthLeft = other.m_growthLeft;
+  }
+
+  FlatHashTable(FlatHashTable&& other) noexcept
+  {
+    swap(other);
+  }
+
+  FlatHashTable& operator=(FlatHashTable other) noexcept
+  {
+    swap(other);
+    return *this;
+  }
+
+  ~FlatHashTable() { release(); }
+
+  void swap(FlatHashTable& other) noexcept
+  {
+    using ::std::swap;
+    swap(m_ctrl, other.m_ctrl);
+    swap(m_slots, other.m_slots);
+    swap(m_capacity, other.m_capacity);
+    swap(m_size, other.m_size);
+    swap(m_growthLeft, other.m_growthLeft);
+    swap(m_hash, other.m_hash);
+    swap(m_eq, other.m_eq);
+  }
+
+  iterator begin()
+  {
+    iterator it(this, 0);
+    it.skipEmpty();
+    return it;
+  }
+  iterator end() { return iterator(this, m_capacity); }
+
+  const_iterator begin() const
+  {
+    const_iterator it(this, 0);
+    it.skipEmpty();
+    return it;
+  }
+  const_iterator end() const { return const_iterator(this, m_capacity); }
+
+  // every slot is a bucket of zero or one elements
+  size_type bucket_count() const { return m_capacity; }
+  local_iterator begin(size_type n) { return m_slots + (isFull(m_ctrl[n]) ? n : n + 1); }
+  local_iterator end(size_type n) { return m_slots + n + 1; }
+  const_local_iterator begin(size_type n) const { return m_slots + (isFull(m_ctrl[n]) ? n : n + 1); }
+  const_local_iterator end(size_type n) const { return m_slots + n + 1; }
+
+  bool empty() const { return m_size == 0; }
+  size_type size() const { return m_size; }
+
+  // removes every element but keeps the allocated slots
+  void clear()
+  {
+    if (!m_capacity)
+      return;
+    destroyAll();
+    ::std::memset(m_ctrl.get(), CTRL_EMPTY, m_capacity);
+    m_size = 0;
+    m_growthLeft = maxLoad(m_capacity);
+  }
+
+  void reserve(size_type n)
+  {
+    size_type capacity = GROUP_SZ;
+    while (maxLoad(capacity) < n)
+      capacity *= 2;
+    if (capacity > m_capacity)
+      resize(capacity);
+  }
+
+  hasher hash_function() const { return m_hash; }
+
+  // insert and find taking the already computed hash_function()(key), for callers that hash the key themselves
+  template <typename V>
+  ::std::pair<iterator, bool> insertHashed(V&& value, ::std::size_t hash)
+  {
+    const auto& key = Policy::key(value);
+    auto h = mixHash(hash);
+    auto slot = findSlot(key, h);
+    if (slot != m_capacity)
+      return { iterator(this, slot), false };
+
+    growIfFull();
+    slot = findInsertSlot(h);
+    m_growthLeft -= m_ctrl[slot] == CTRL_EMPTY;
+    m_ctrl[slot] = static_cast<ctrl_t>(h & 0x7F);
+    ::std::construct_at(m_slots + slot, ::std::forward<V>(value));
+    ++m_size;
+    return { iterator(this, slot), true };
+  }
+
+  iterator findHashed(const key_type& key, ::std::size_t hash)
+  {
+    return iterator(this, findSlot(key, mixHash(hash)));
+  }
+
+  const_iterator findHashed(const key_type& key, ::std::size_t hash) const
+  {
+    return const_iterator(this, findSlot(key, mixHash(hash)));
+  }
+
+  template <typename V>
+  ::std::pair<iterator, bool> insert(V&& value)
+  {
+    auto hash = m_hash(Policy::key(value));
+    return insertHashed(::std::forward<V>(value), hash);
+  }
+
+  ::std::pair<iterator, bool> insert(const value_type& value) { return insert<const value_type&>(value); }
+  ::std::pair<iterator, bool> insert(value_type&& value) { return insert<value_type>(::std::move(value)); }
+
+  template <typename InputIt>
+  void insert(InputIt first, InputIt last)
+  {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  template <typename... Args>
+  ::std::pair<iterator, bool> emplace(Args&&... args)
+  {
+    return insert(value_type(::std::forward<Args>(args)...));
+  }
+
+  iterator find(const key_type& key) { return findHashed(key, m_hash(key)); }
+  const_iterator find(const key_type& key) const { return findHashed(key, m_hash(key)); }
+
+  bool contains(const key_type& key) const { return find(key) != end(); }
+  size_type count(const key_type& key) const { return contains(key); }
+
+  size_type erase(const key_type& key)
+  {
+    auto slot = findSlot(key, mixHash(m_hash(key)));
+    if (slot == m_capacity)
+      return 0;
+    ::std::destroy_at(m_slots + slot);
+    m_ctrl[slot] = CTRL_DELETED;
+    --m_size;
+    return 1;
+  }
+};
+
+template <typename Key, typename Hash = ::std::hash<Key>, typename KeyEqual = ::std::equal_to<Key>>
+using FlatHashSet = FlatHashTable<Key, Key, FlatSetPolicy, Hash, KeyEqual>;
+
+template <typename Key, typename T, typename Hash = ::std::hash<Key>, typename KeyEqual = ::std::equal_to<Key>>
+class FlatHashMap : public FlatHashTable<Key, ::std::pair<const Key, T>, FlatMapPolicy, Hash, KeyEqual>
+{
+  using base_t = FlatHashTable<Key, ::std::pair<const Key, T>, FlatMapPolicy, Hash, KeyEqual>;
+
+public:
+  using mapped_type = T;
+  using base_t::base_t;
+
+  T& operator[](const Key& key)
+  {
+    auto it = this->find(key);
+    if (it == this->end())
+      it = this->insert(typename base_t::value_type(key, T{})).first;
+    return it->second;
+  }
+
+  T& at(const Key& key)
+  {
+    auto it = this->find(key);
+    if (it == this->end())
+      throw ::std::out_of_range("FlatHashMap::at");
+    return it->second;
+  }
+
+  const T& at(const Key& key) const
+  {
+    auto it = this->find(key);
+    if (it == this->end())
+      throw ::std::out_of_range("FlatHashMap::at");
+    return it->second;
+  }
+};
+
+#endif
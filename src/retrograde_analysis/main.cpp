@@ -25,6 +25,11 @@
 #include <stdio.h>
 #include <cctype>
 #include <chrono>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
 
 #include "probe.hpp"
 
@@ -111,6 +116,107 @@ auto readClArgs(int argc, char* argv[],
   return userset;
 }
 
+struct ClFlags
+{
+  // empty if no checkpoint is kept. The cluster solver keeps its checkpoints in this directory
+  std::string path;
+  bool resume = false;
+  // number of cluster iterations (major or minor) between checkpoints
+  int interval = 1;
+  // if positive, the cluster solver runs this many ranks as threads of this process instead of using MPI
+  int ranks = 0;
+  // if not empty, the cluster ranks write their results to this tablebase file
+  std::string output;
+};
+
+// removes the --checkpoint=<path>, --checkpoint_interval=<n>, --resume, --ranks=<n> and --output=<path> 
+// flags from argv, leaving the positional arguments in order
+auto readClFlags(int& argc, char* argv[])
+{
+  ClFlags args;
+  int positional = 1;
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strncmp(argv[i], "--checkpoint=", 13) == 0)
+      args.path = argv[i] + 13;
+    else if (std::strncmp(argv[i], "--checkpoint_interval=", 22) == 0)
+      args.interval = std::stoi(argv[i] + 22);
+    else if (std::strcmp(argv[i], "--resume") == 0)
+      args.resume = true;
+    else if (std::strncmp(argv[i], "--ranks=", 8) == 0)
+      args.ranks = std::stoi(argv[i] + 8);
+    else if (std::strncmp(argv[i], "--output=", 9) == 0)
+      args.output = argv[i] + 9;
+    else
+      argv[positional++] = argv[i];
+  }
+  argc = positional;
+
+  if (args.resume && args.path.empty())
+  {
+    std::cerr << "ERROR: --resume requires --checkpoint=<path>" << std::endl;
+    assert(false);
+  }
+#ifdef OUT_OF_CORE
+  if (!args.path.empty())
+  {
+    std::cerr << "ERROR: out-of-core builds do not support --checkpoint" << std::endl;
+    assert(false);
+  }
+#endif
+#ifdef CLUSTER_RMA
+  if (!args.path.empty() || !args.output.empty() || args.ranks > 0)
+  {
+    std::cerr << "ERROR: --enable_rma builds do not support --checkpoint, --output or --ranks" << std::endl;
+    assert(false);
+  }
+#endif
+  if (args.ranks > 0 && !args.path.empty())
+  {
+    std::cerr << "ERROR: cluster checkpoints need MPI ranks, not --ranks=<n>" << std::endl;
+    assert(false);
+  }
+  if (args.ranks > 0 && !args.output.empty())
+  {
+    std::cerr << "ERROR: tablebase output needs MPI ranks, not --ranks=<n>" << std::endl;
+    assert(false);
+  }
+  return args;
+}
+
+#ifdef MULTI_NODE
+// starts MPI for ranks whose OpenMP threads leave every MPI call to the main thread
+void initFunneledMpi(void)
+{
+  int threadSupport = 0;
+  MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &threadSupport);
+  if (threadSupport < MPI_THREAD_FUNNELED)
+  {
+    std::cerr << "ERROR: the MPI library does not support MPI_THREAD_FUNNELED" << std::endl;
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+}
+#endif
+
+#if defined(MULTI_NODE) && !defined(CLUSTER_RMA)
+// commits MPI_NonPlacementDataType for the chess non placement data sent between ranks
+void initialize_chess_non_placement(void)
+{
+  int count = 1;
+  int blocklengths[] = { 1 };
+  MPI_Aint displacements[] = { offsetof(ChessNPD, enpassantRights) };
+  MPI_Datatype types[] = { MPI_INT };
+
+  MPI_Datatype tmp;
+  MPI_Aint lowerBound;
+  MPI_Aint extent;
+  MPI_Type_create_struct(count, blocklengths, displacements, types, &tmp);
+  MPI_Type_get_extent(tmp, &lowerBound, &extent);
+  MPI_Type_create_resized(tmp, lowerBound, extent, &MPI_NonPlacementDataType);
+  MPI_Type_commit(&MPI_NonPlacementDataType);
+}
+#endif
+
 // look out for clashing of macros with actual function names
 int main(int argc, char* argv[])
 {
@@ -122,6 +228,7 @@ int main(int argc, char* argv[])
   std::vector<piece_label_t> noRoyaltyPieceset = NON_ROYAL_PIECES;
   std::vector<piece_label_t> royaltyPieceset = ROYAL_PIECES;
 
+  ClFlags clFlags = readClFlags(argc, argv);
   std::vector<piece_label_t> fullPieceset = readClArgs(argc, argv, royaltyPieceset);
 
 
@@ -142,10 +249,42 @@ int main(int argc, char* argv[])
   auto t1 = std::chrono::high_resolution_clock::now();
   auto cmDuration = std::chrono::duration_cast<std::chrono::milliseconds>(t1-t0).count();
   
+#if defined(OUT_OF_CORE)
+  // result and frontier files go to the directory given after the pieceset, and the
+  // frontier buffers are bounded by the budget in MiB given after it
+  OutOfCoreConfig outOfCoreConfig{ argc > 2 ? argv[2] : ".", 
+    (argc > 3 ? std::stoull(argv[3]) : 1024) << 20 };
+  DenseResultStore<FLATTENED_SZ, NON_PLACEMENT_DATATYPE> store{MaterialIndexer<FLATTENED_SZ>(fullPieceset), 
+    outOfCoreConfig.dir};
+#elif defined(DENSE_RESULT_STORE)
+  // packed WDL and depth-to-mate arrays indexed over the pieceset and its captures
+  DenseResultStore<FLATTENED_SZ, NON_PLACEMENT_DATATYPE> store{MaterialIndexer<FLATTENED_SZ>(fullPieceset)};
+#else
+  HashResultStore<FLATTENED_SZ, NON_PLACEMENT_DATATYPE> store;
+#endif
   t0 = std::chrono::high_resolution_clock::now();
-  auto [wins, losses, dtm] = retrogradeAnalysisBaseImpl<FLATTENED_SZ, NON_PLACEMENT_DATATYPE, N_MAN, ROW_SZ, 
-      COL_SZ, decltype(forward), decltype(reverse)>(::std::move(checkmates),
-      forward, reverse);
+#ifdef OUT_OF_CORE
+  retrogradeAnalysisOutOfCoreImpl<FLATTENED_SZ, NON_PLACEMENT_DATATYPE, N_MAN, ROW_SZ, 
+      COL_SZ, decltype(forward), decltype(reverse)>(store, checkmates, forward, reverse,
+      outOfCoreConfig);
+#else
+  // the labels of every completed iteration are logged, and a resumed run replays them
+  std::unique_ptr<CheckpointLog<decltype(checkmates)::value_type, decltype(store)>> checkpoint;
+  if (!clFlags.path.empty())
+  {
+    std::optional<MaterialIndexer<FLATTENED_SZ>> checkpointIndexer;
+#ifndef DENSE_RESULT_STORE
+    // the hash store holds raw boards, so the log indexes the positions itself when the material fits
+    if (MaterialIndexer<FLATTENED_SZ>::indexable(fullPieceset))
+      checkpointIndexer.emplace(fullPieceset);
+#endif
+    checkpoint = std::make_unique<CheckpointLog<decltype(checkmates)::value_type, decltype(store)>>(
+        clFlags.path, clFlags.resume, std::move(checkpointIndexer));
+  }
+  retrogradeAnalysisBaseImpl<FLATTENED_SZ, NON_PLACEMENT_DATATYPE, N_MAN, ROW_SZ, 
+      COL_SZ, decltype(forward), decltype(reverse)>(store, ::std::move(checkmates),
+      forward, reverse, {}, {}, {}, checkpoint.get());
+#endif
   t1 = std::chrono::high_resolution_clock::now();
   auto rgDuration = std::chrono::duration_cast<std::chrono::milliseconds>(t1-t0).count();
   
@@ -153,7 +292,7 @@ int main(int argc, char* argv[])
   std::cout << "Checkmate identification execution time: " << cmDuration << " ms" << std::endl;
   std::cout << "Retrograde analysis execution time: " << rgDuration << " ms" << std::endl;
   std::cout << "-----------------------------------------" << std::endl;
-  std::cout << "Number of wins: " << wins.size() << " Number of losses: " << losses.size() << std::endl; 
+  std::cout << "Number of wins: " << store.numWins() << " Number of losses: " << store.numLosses() << std::endl; 
   std::cout << "-----------------------------------------" << std::endl;
   // todo: adjust this to be generic
   auto boardPrinter = BOARD_PRINTER();
@@ -164,16 +303,17 @@ int main(int argc, char* argv[])
     auto boardToQuery = readBoardInput<decltype(checkmates)::value_type>(fullPieceset);
 
     bool iteration;
-    if (wins.find(boardToQuery) != wins.end())
+    auto status = store.status(boardToQuery);
+    if (status == WDL::WIN)
     {
       iteration = true;
-      auto [depthToEnd, path] = probe(boardToQuery, dtm, forward, iteration, boardPrinter);
+      auto [depthToEnd, path] = probe(boardToQuery, store, forward, iteration, boardPrinter);
       std::cout << "Number of moves until the end: " << depthToEnd << std::endl;
     }
-    else if (losses.find(boardToQuery) != losses.end())
+    else if (status == WDL::LOSS)
     {
       iteration = false;
-      auto [depthToEnd, path] = probe(boardToQuery, dtm, forward, iteration, boardPrinter);
+      auto [depthToEnd, path] = probe(boardToQuery, store, forward, iteration, boardPrinter);
       std::cout << "Number of moves until the end: " << depthToEnd << std::endl;
     }
     else
@@ -190,11 +330,8 @@ int main(int argc, char* argv[])
   } while (loop);
      
 #else
-  MPI_Init(NULL, NULL);
-  
-  //initialize_chess_non_placement();
-  // user must initialize non placement type
-  //initialize_comm_structs<64, ChessNPD>();
+#ifdef CLUSTER_RMA
+  initFunneledMpi();
 
   int global_sz = 0;
   MPI_Comm_size(MPI_COMM_WORLD, &global_sz); 
@@ -202,26 +339,100 @@ int main(int argc, char* argv[])
   int rank = 0;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     
-  KStateSpacePartition<64, BoardState<64, ChessNPD>> partitioner(fullPieceset[0], global_sz); 
+  // the windows of the one-sided updates are laid out by contiguous ranges of position indices
+  IndexRangeStateSpacePartition<64, ChessNPD> partitioner(MaterialIndexer<64>(fullPieceset), global_sz);
   std::unordered_set<BoardState<64, ChessNPD>, BoardStateHasher<64, ChessNPD>> localCheckmates;
   
   localCheckmates = generatePartitionCheckmates<64>(rank, partitioner, 
-      std::move(localCheckmates), fullPieceset, winEval); 
+      std::move(localCheckmates), fullPieceset, winEval, isValidBoardFn); 
   
-  // wait until everyone is done before logging the time 
   auto t0 = std::chrono::high_resolution_clock::now();
-  auto [wins, losses, dtm] = retrogradeAnalysisClusterImpl<64, NON_PLACEMENT_DATATYPE, N_MAN, ROW_SZ, COL_SZ, 
+  auto results = retrogradeAnalysisClusterRmaImpl<64, NON_PLACEMENT_DATATYPE, N_MAN, ROW_SZ, COL_SZ, 
     decltype(forward), decltype(reverse)>(partitioner, rank, global_sz, 
-    std::move(localCheckmates), forward, reverse);
+    localCheckmates, forward, reverse);
   auto t1 = std::chrono::high_resolution_clock::now();
   auto runtime = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
   
-  std::cout << global_sz << " " << wins.size() << " " << losses.size() << std::endl;
+  std::cout << global_sz << " " << results.numWins() << " " << results.numLosses() << std::endl;
   // after sync, one node should output elapsed time 
   if (rank == 0)
     std::cout << global_sz << "," << runtime << std::endl;
 
   MPI_Finalize();
+#else
+  // solves the positions of one rank, which communicates over the given transport, and returns its wins, 
+  // losses and their depths
+  auto solveRank = [&](auto& transport, ClusterCheckpoint* checkpoint)
+  {
+    int global_sz = transport.size();
+    int rank = transport.rank();
+
+    HashStateSpacePartition<64, ChessNPD> partitioner(global_sz); 
+    std::unordered_set<BoardState<64, ChessNPD>, BoardStateHasher<64, ChessNPD>> localCheckmates;
+    
+#ifdef CLUSTER_DYNAMIC_CHECKMATES
+    // the ranks take chunks of the positions as they go, then trade the checkmates they found
+    localCheckmates = generateDynamicPartitionCheckmates<64, ChessNPD>(transport, partitioner, 
+        std::move(localCheckmates), fullPieceset, winEval, isValidBoardFn); 
+#else
+    localCheckmates = generatePartitionCheckmates<64>(rank, partitioner, 
+        std::move(localCheckmates), fullPieceset, winEval, isValidBoardFn); 
+#endif
+
+#ifdef CLUSTER_PACKED_WIRE
+    // predecessors are sent as their index among the positions of the full pieceset and its captures
+    PackedWireFormat<64, NodeCommData<64, ChessNPD>> wireFormat{ MaterialIndexer<64>(fullPieceset) };
+    const auto* wireFormatPtr = &wireFormat;
+#else
+    const PackedWireFormat<64, NodeCommData<64, ChessNPD>>* wireFormatPtr = nullptr;
+#endif
+
+    // wait until everyone is done before logging the time 
+    auto t0 = std::chrono::high_resolution_clock::now();
+    auto [wins, losses, dtm] = retrogradeAnalysisClusterImpl<64, NON_PLACEMENT_DATATYPE, N_MAN, ROW_SZ, COL_SZ, 
+      decltype(forward), decltype(reverse)>(partitioner, rank, global_sz, 
+      std::move(localCheckmates), forward, reverse, {}, {}, {}, checkpoint, wireFormatPtr, transport);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto runtime = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+    
+    // in-process ranks share the stream, so each line is written at once
+    std::cout << (std::to_string(global_sz) + " " + std::to_string(wins.size()) + " " 
+        + std::to_string(losses.size()) + "\n") << std::flush;
+    // after sync, one node should output elapsed time 
+    if (rank == 0)
+      std::cout << (std::to_string(global_sz) + "," + std::to_string(runtime) + "\n") << std::flush;
+    return std::make_tuple(std::move(wins), std::move(losses), std::move(dtm));
+  };
+
+  if (clFlags.ranks > 0)
+  {
+    runInProcessCluster(clFlags.ranks, [&](InProcessTransport& transport) { solveRank(transport, nullptr); });
+  }
+  else
+  {
+    // each rank runs its iterations on OpenMP threads, but only the main thread calls MPI
+    initFunneledMpi();
+
+    // user must initialize non placement type
+    initialize_chess_non_placement();
+    initialize_comm_structs<64, ChessNPD>();
+
+    MpiTransport transport;
+    // every rank writes its shard of each checkpoint to the shared directory
+    std::unique_ptr<ClusterCheckpoint> checkpoint;
+    if (!clFlags.path.empty())
+      checkpoint = std::make_unique<ClusterCheckpoint>(clFlags.path, transport.rank(), transport.size(), 
+          clFlags.interval, clFlags.resume);
+    auto [wins, losses, dtm] = solveRank(transport, checkpoint.get());
+
+    // every rank writes its slice of the tablebase at once
+    if (!clFlags.output.empty())
+      ClusterTablebase::write(clFlags.output, transport.rank(), transport.size(), "hash", fullPieceset,
+          wins, losses, dtm);
+
+    MPI_Finalize();
+  }
+#endif
 #endif
 #else
   std::cerr << "ERROR: Invalid configuration file" << std::endl;
@@ -0,0 +1,114 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Zero initialized arrays of trivially copyable elements backed by a memory mapping. The mapping is either
+ * anonymous (held in memory and swap like a heap allocation) or a shared mapping of a file, in which case the
+ * kernel pages the array in and out of the file and arrays larger than physical memory may be used.
+ * Pages are only allocated once they are touched.
+ */
+
+#ifndef MAPPED_ARRAY_HPP_
+#define MAPPED_ARRAY_HPP_
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+template <typename T>
+class MappedArray
+{
+  static_assert(::std::is_trivially_copyable_v<T>, "mapped arrays hold raw bytes");
+
+  T* m_data = nullptr;
+  ::std::size_t m_size = 0;
+
+  static ::std::runtime_error error(const ::std::string& what)
+  {
+    return ::std::runtime_error(what + ": " + ::std::strerror(errno));
+  }
+
+  static ::std::size_t bytesOf(::std::size_t n) { return n ? n * sizeof(T) : 1; }
+
+public:
+  MappedArray() = default;
+
+  // anonymous mapping of n elements
+  explicit MappedArray(::std::size_t n)
+    : m_size(n)
+  {
+    void* p = ::mmap(nullptr, bytesOf(n), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw error("mmap");
+    m_data = static_cast<T*>(p);
+  }
+
+  // maps n elements of the file at path, which is created or truncated to all zeros
+  MappedArray(const ::std::string& path, ::std::size_t n)
+    : m_size(n)
+  {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw error("open " + path);
+    if (::ftruncate(fd, static_cast<off_t>(bytesOf(n))) != 0)
+    {
+      ::close(fd);
+      throw error("ftruncate " + path);
+    }
+    void* p = ::mmap(nullptr, bytesOf(n), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // the mapping keeps the file open
+    ::close(fd);
+    if (p == MAP_FAILED)
+      throw error("mmap " + path);
+    m_data = static_cast<T*>(p);
+  }
+
+  MappedArray(const MappedArray&) = delete;
+  MappedArray& operator=(const MappedArray&) = delete;
+
+  MappedArray(MappedArray&& other) noexcept
+    : m_data(::std::exchange(other.m_data, nullptr)), m_size(::std::exchange(other.m_size, 0))
+  {
+  }
+
+  MappedArray& operator=(MappedArray&& other) noexcept
+  {
+    ::std::swap(m_data, other.m_data);
+    ::std::swap(m_size, other.m_size);
+    return *this;
+  }
+
+  ~MappedArray()
+  {
+    if (m_data)
+      ::munmap(m_data, bytesOf(m_size));
+  }
+
+  T* data() { return m_data; }
+  const T* data() const { return m_data; }
+  ::std::size_t size() const { return m_size; }
+
+  T& operator[](::std::size_t i) { return m_data[i]; }
+  const T& operator[](::std::size_t i) const { return m_data[i]; }
+};
+
+#endif
@@ -21,16 +21,44 @@
 #ifndef MULTI_NODE_IMPL_HPP_
 
 #include <cmath>
-#include <list>
 #include <cassert>
 #include <iostream>
 #include <cstddef>
 #include <algorithm>
+#include <iterator>
+#include <vector>
 
 #include <mpi.h>
+#include <omp.h>
 
 #include "state.hpp"
 #include "checkmate_generation.hpp"
+#include "flat_hash_table.hpp"
+#include "cluster_checkpoint.hpp"
+#include "cluster_tablebase.hpp"
+#include "state_space_partition.hpp"
+#include "wire_format.hpp"
+#include "cluster_transport.hpp"
+
+// Number of predecessors batched into one message to a rank. Override at compile time to tune
+#ifndef CLUSTER_SEND_BATCH_SZ
+#  define CLUSTER_SEND_BATCH_SZ 4096
+#endif
+
+// Number of frontier entries the threads of a rank walk between two rounds of sending and receiving batches
+#ifndef CLUSTER_POLL_CHUNK_SZ
+#  define CLUSTER_POLL_CHUNK_SZ 4096
+#endif
+
+#if defined(CLUSTER_ALLTOALL) && defined(CLUSTER_ASYNC_TERMINATION)
+#  error "CLUSTER_ALLTOALL and CLUSTER_ASYNC_TERMINATION are different ways of ending an iteration"
+#endif
+
+// Point to point iterations end with a message from every rank to every other, unless the end is detected
+// with a non-blocking reduction
+#if !defined(CLUSTER_ALLTOALL) && !defined(CLUSTER_ASYNC_TERMINATION)
+#  define CLUSTER_END_OF_ITERATION_MSGS
+#endif
 
 // Global MPI type definitions. Must be initialized in main with initialize_comm_structs
 MPI_Datatype MPI_NodeCommData;
@@ -46,6 +74,12 @@ struct NodeCommData
   BoardState<FlattenedSz, NonPlacementDataType> b; 
 };
 
+template <::std::size_t FlattenedSz, typename NonPlacementDataType>
+struct mpi_datatype<NodeCommData<FlattenedSz, NonPlacementDataType>>
+{
+  static MPI_Datatype get(void) { return MPI_NodeCommData; }
+};
+
 template<::std::size_t FlattenedSz, typename NonPlacementDataType>
 bool operator==(const NodeCommData<FlattenedSz, NonPlacementDataType>& x, const NodeCommData<FlattenedSz, NonPlacementDataType>& y){
 	return x.b == y.b;
@@ -84,7 +118,14 @@ void initialize_comm_structs(void)
     typedef BoardState<FlattenedSz, NonPlacementDataType> board_state_t;
 
     int count = 3;
+#if defined(BITBOARD_STATE) || defined(ZOBRIST_HASHING)
+    // the bitboards and zobrist key are sent as raw bytes
+    int blocklengths[] = { 1, sizeof(board_placement_t<FlattenedSz>), 1 };
+    MPI_Datatype placementType = MPI_BYTE;
+#else
     int blocklengths[] = { 1, FlattenedSz, 1 };
+    MPI_Datatype placementType = MPI_CHAR;
+#endif
 
     MPI_Aint displacements[] = 
     { 
@@ -93,7 +134,7 @@ void initialize_comm_structs(void)
       offsetof(board_state_t, nonPlacementData)
     };
     
-    MPI_Datatype types[] = { MPI_C_BOOL, MPI_CHAR, MPI_NonPlacementDataType };
+    MPI_Datatype types[] = { MPI_C_BOOL, placementType, MPI_NonPlacementDataType };
     
     MPI_Datatype tmp;
     MPI_Aint lowerBound;
@@ -102,8 +143,9 @@ void initialize_comm_structs(void)
     MPI_Type_create_struct(count, blocklengths, displacements, types,
       &tmp);
 
+    // batches are arrays, so the extent must match the C++ stride including trailing padding
     MPI_Type_get_extent(tmp, &lowerBound, &extent);
-    MPI_Type_create_resized(tmp, lowerBound, extent, &MPI_BoardState);
+    MPI_Type_create_resized(tmp, lowerBound, sizeof(board_state_t), &MPI_BoardState);
     MPI_Type_commit(&MPI_BoardState);
   }
   
@@ -134,215 +176,594 @@ void initialize_comm_structs(void)
     MPI_Type_create_struct(count, blocklengths, displacements, types,
       &tmp);
     MPI_Type_get_extent(tmp, &lowerBound, &extent);
-    MPI_Type_create_resized(tmp, lowerBound, extent, &MPI_NodeCommData);
+    MPI_Type_create_resized(tmp, lowerBound, sizeof(node_comm_data_t), &MPI_NodeCommData);
     MPI_Type_commit(&MPI_NodeCommData);
   }
 }
 
-// The major iteration of retrograde analysis. Win states are identified in this iteration
-template <typename WinFrontier, typename LoseFrontier, typename Partitioner, typename PredStore, typename EndGameSet,
-  typename PredecessorGen, typename BoardMap>
-inline auto do_majorIteration(int id, short v, int numProcs, const Partitioner& p, PredStore& predStore, 
-    BoardMap&& boardMap, LoseFrontier& loseFrontier, WinFrontier&& winFrontier,
-    const EndGameSet& losses, EndGameSet&& wins, PredecessorGen predFn)
+/*
+ * Buffer of the message that ends an iteration. The receiver only reads its tag, but the buffer must stay
+ * valid until the send completes, which a frontier element does not: inserting into a flat frontier may
+ * move its elements.
+ */
+template <typename CommData>
+CommData* endOfIterationMsg(void)
 {
-  // TODO: See if finer grain parallelism can be employed with OpenMP (otherwise just launch more
-  // MPI processes)
-  bool b_localAssignedWork = false;
-  ::std::vector<MPI_Request*> sendRequests;
-  for (auto& frontierState : loseFrontier)
+  static CommData msg{ false, 0, { false, {}, {} } };
+  return &msg;
+}
+
+/*
+ * Per destination buffers that batch the predecessors sent to other ranks. A buffer is sent as one message
+ * once it holds batchSz predecessors, and the rest are sent by flushAll at the end of the iteration.
+ *
+ * Every send, including the end of iteration messages, takes a slot of a pool that holds its batch and its
+ * request. The slots of completed sends are reclaimed with testsome whenever the pool runs out, and
+ * waitAll or testAll free every slot at the end of the iteration. Slots keep their request and the capacity of
+ * their batch across iterations, so once the pool covers the sends in flight, sending allocates nothing.
+ *
+ * With CLUSTER_ALLTOALL defined, nothing is sent point to point. The buffers hold every predecessor of the
+ * iteration until do_syncAndFree exchanges them all in one collective call.
+ *
+ * With CLUSTER_ASYNC_TERMINATION defined, a rank may receive the batches of the next iteration while it
+ * still waits for the current one to end, so consecutive iterations send their batches with different tags.
+ *
+ * Given a wire format, batches are packed with it and sent as bytes (see wire_format.hpp).
+ */
+template <typename CommData, typename WireFormat, typename Transport>
+class PredecessorSendBuffers
+{
+  Transport& m_transport;
+  ::std::vector<::std::vector<CommData>> m_buffers;
+  // the pool of send slots. A slot is free once its request is null
+  ::std::vector<::std::vector<CommData>> m_sent;
+  ::std::vector<::std::vector<unsigned char>> m_sentBytes;
+  ::std::vector<typename Transport::request_t> m_requests;
+  ::std::vector<int> m_freeSlots;
+  // scratch for testsome
+  ::std::vector<int> m_completed;
+  ::std::size_t m_batchSz;
+  const WireFormat* m_wireFormat;
+  // tag of the batches of the current iteration
+  int m_tag = 0;
+
+  template <typename T>
+  void send(const T* data, int count, int targetId, typename Transport::request_t* r)
+  {
+#ifdef CLUSTER_ASYNC_TERMINATION
+    // the send only completes once the receiver has matched it, which do_syncAndFree relies on
+    m_transport.issend(data, count, targetId, m_tag, r);
+#else
+    m_transport.isend(data, count, targetId, m_tag, r);
+#endif
+  }
+
+  // frees the slots of the sends that have completed
+  void reclaim(void)
   {
-    if (wins.find(frontierState.b) == wins.end())
+    int numCompleted = m_transport.testsome(m_requests, m_completed.data());
+    m_freeSlots.insert(m_freeSlots.end(), m_completed.begin(), m_completed.begin() + numCompleted);
+  }
+
+  // returns a free slot, growing the pool only if no send has completed
+  int acquireSlot(void)
+  {
+    if (m_freeSlots.empty())
+      reclaim();
+    if (m_freeSlots.empty())
     {
-      auto preds = predFn(frontierState.b);
-      wins.insert(frontierState.b);
+      m_sent.emplace_back();
+      m_sentBytes.emplace_back();
+      m_requests.push_back(Transport::nullRequest());
+      m_completed.push_back(0);
+      return static_cast<int>(m_requests.size()) - 1;
+    }
+    int slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    return slot;
+  }
 
-      for (auto&& pred : preds)
+  void releaseAll(void)
+  {
+    m_freeSlots.clear();
+    for (int i = 0; i < static_cast<int>(m_requests.size()); ++i)
+      m_freeSlots.push_back(i);
+  }
+
+public:
+  PredecessorSendBuffers(Transport& transport, ::std::size_t batchSz=CLUSTER_SEND_BATCH_SZ,
+      const WireFormat* wireFormat=nullptr)
+    : m_transport(transport), m_buffers(transport.size()), m_batchSz(batchSz), m_wireFormat(wireFormat)
+  {
+  }
+
+  template <typename... Args>
+  void emplace(int targetId, Args&&... args)
+  {
+    auto& buffer = m_buffers[targetId];
+    if (buffer.empty())
+      buffer.reserve(m_batchSz);
+    buffer.push_back({ ::std::forward<Args>(args)... });
+#ifndef CLUSTER_ALLTOALL
+    if (buffer.size() >= m_batchSz)
+      flush(targetId);
+#endif
+  }
+
+  void flush(int targetId)
+  {
+    auto& buffer = m_buffers[targetId];
+    if (buffer.empty())
+      return;
+    int slot = acquireSlot();
+    if (m_wireFormat)
+    {
+      // the packed copy is sent, so the buffer keeps its capacity for the next batch
+      auto& bytes = m_sentBytes[slot];
+      bytes.clear();
+      m_wireFormat->pack(buffer.data(), buffer.size(), bytes);
+      buffer.clear();
+      send(bytes.data(), static_cast<int>(bytes.size()), targetId, &m_requests[slot]);
+      return;
+    }
+    // the buffer takes over the capacity of the batch the slot sent last
+    auto& sent = m_sent[slot];
+    sent.swap(buffer);
+    buffer.clear();
+    send(sent.data(), static_cast<int>(sent.size()), targetId, &m_requests[slot]);
+  }
+
+  // sends every partial batch. Must precede the end of iteration messages, which may not overtake them
+  void flushAll(void)
+  {
+    for (int i = 0; i < static_cast<int>(m_buffers.size()); ++i)
+      flush(i);
+  }
+
+  // tells targetId that this rank has sent all of its batches, and with tag 1 rather than 2, that it
+  // assigned work
+  void sendEndOfIteration(int targetId, int tag)
+  {
+    int slot = acquireSlot();
+    m_transport.isend(endOfIterationMsg<CommData>(), 1, targetId, tag, &m_requests[slot]);
+  }
+
+  // waits for every send of the iteration to complete
+  void waitAll(void)
+  {
+    m_transport.waitall(m_requests);
+    releaseAll();
+  }
+
+  // whether every send of the iteration has completed, which for a synchronous send means it was matched
+  bool testAll(void)
+  {
+    bool b_complete = m_transport.testall(m_requests);
+    if (b_complete)
+      releaseAll();
+    return b_complete;
+  }
+
+  // predecessors buffered for targetId and not yet sent
+  const ::std::vector<CommData>& pending(int targetId) const { return m_buffers[targetId]; }
+
+  int tag(void) const { return m_tag; }
+
+  const WireFormat* wireFormat(void) const { return m_wireFormat; }
+
+  // ends the iteration. Must only be called once waitAll or testAll has seen every send complete
+  void clear(void)
+  {
+    for (auto& buffer : m_buffers)
+      buffer.clear();
+#ifdef CLUSTER_ASYNC_TERMINATION
+    m_tag ^= 1;
+#endif
+  }
+};
+
+// Adds the predecessors received from other ranks, or found locally, to the frontier and updates their 
+// estimate data
+template<bool fromWinIteration, typename CommDataBatch, typename BoardMap, typename BoardSet, typename Frontier> 
+void do_processReceived(short v, const CommDataBatch& recvBatch, const BoardSet& wins, const BoardSet& losses,
+    BoardMap& boardMap, Frontier& frontier)
+{
+  for (const auto& recvBuf : recvBatch)
+  {
+    if (wins.find(recvBuf.b) == wins.end() 
+        && losses.find(recvBuf.b) == losses.end())
+    {
+      frontier.insert(recvBuf);
+
+      if constexpr (fromWinIteration)
       {
-        auto targetId = p(pred);
-        if (targetId == id)
+        // We initialize remaining moves to -1 and handle later. It is too 
+        // expensive to handle calculating successors here.
+        if (boardMap.find(recvBuf.b) == boardMap.end())
         {
-          auto [_, b_insert] = winFrontier.insert({true, v, ::std::move(pred)}); // tell the predecessor that the current state wins in v moves.
-          if (b_insert)
-            b_localAssignedWork = true;
+          boardMap[recvBuf.b] = 
+            { 0, recvBuf.G, -1 }; 
         }
+        // Decrement loss counter and determine current longest path to a loss
         else
         {
-          predStore.emplace_back(true, v, ::std::move(pred));
-          b_localAssignedWork = true;
-          // perform MPI send from current to targetId
-          MPI_Request* r = new MPI_Request(); // receiver responsible for knowing 
-          sendRequests.push_back(r);
-          MPI_Isend(&(predStore.back()), 1, MPI_NodeCommData, targetId, 0,
-            MPI_COMM_WORLD, r);
+          auto& estimateNodeData = boardMap[recvBuf.b];
+          --(estimateNodeData.C);
+          estimateNodeData.M = ::std::max(estimateNodeData.M, recvBuf.G);
         }
       }
+      else // from lose iteration
+      {
+        if (boardMap.find(recvBuf.b) == boardMap.end())
+          boardMap[recvBuf.b] = { static_cast<short>(v + 1), {}, {} }; // last two fields are only relevant to potentially lost states.  
+        else
+          boardMap[recvBuf.b].T = static_cast<short>(v + 1); 
+      }
     }
   }
-  // currently use null board. can be extended in the future to pack the last message
-  for (int i = 0; i < numProcs; ++i)
+}
+
+/*
+ * Predecessors found by the OpenMP threads of a rank, indexed by thread and then by the rank that owns them.
+ * The threads never call MPI themselves. Between chunks of the frontier walk, do_dispatchPredecessors hands 
+ * the buffers to the send buffers, or to the local predecessors, in thread order. Under a static schedule 
+ * this is the order of a serial walk of the frontier, so results do not depend on the number of threads.
+ */
+template <typename CommData>
+using thread_pred_buffers_t = ::std::vector<::std::vector<::std::vector<CommData>>>;
+
+template <typename CommData>
+thread_pred_buffers_t<CommData> makeThreadPredBuffers(int numProcs)
+{
+  return thread_pred_buffers_t<CommData>(omp_get_max_threads(), ::std::vector<::std::vector<CommData>>(numProcs));
+}
+
+// returns whether any predecessor was found. Those of the current rank are appended to staged, to go through
+// the same processing as those received from other ranks
+template <typename CommData, typename PredStore>
+bool do_dispatchPredecessors(int id, thread_pred_buffers_t<CommData>& threadPreds, PredStore& predStore,
+    ::std::vector<CommData>& staged)
+{
+  bool b_localAssignedWork = false;
+  for (auto& localPreds : threadPreds)
   {
-    if (i != id)
+    for (int targetId = 0; targetId < static_cast<int>(localPreds.size()); ++targetId)
     {
-      MPI_Request* r = new MPI_Request();
-      sendRequests.push_back(r);
-      
-      if (loseFrontier.empty())
-          loseFrontier.insert({false, 0, { false, {}, {} }});
-      
-      if (b_localAssignedWork)
-      { 
-        MPI_Isend(&(*loseFrontier.begin()), 1, MPI_NodeCommData, i, 1,
-          MPI_COMM_WORLD, r);
+      auto& preds = localPreds[targetId];
+      if (preds.empty())
+        continue;
+      b_localAssignedWork = true;
+      if (targetId == id)
+      {
+        staged.insert(staged.end(), ::std::make_move_iterator(preds.begin()), 
+            ::std::make_move_iterator(preds.end()));
       }
       else
       {
-        MPI_Isend(&(*loseFrontier.begin()), 1, MPI_NodeCommData, i, 2,
-          MPI_COMM_WORLD, r);
+        // batched for the MPI send from current to targetId
+        for (auto& commData : preds)
+          predStore.emplace(targetId, ::std::move(commData));
       }
+      preds.clear();
     }
   }
-  return ::std::make_tuple(b_localAssignedWork, sendRequests,
-    ::std::move(boardMap), ::std::move(winFrontier), ::std::move(wins));
+  return b_localAssignedWork;
 }
 
-// Performs the minor iteration of retrograde analysis where loss moves are identified
-template <typename WinFrontier, typename LoseFrontier, typename Partitioner, typename PredStore, typename EndGameSet, 
-  typename PredecessorGen, typename SuccessorGen, typename BoardMap>
-inline auto do_minorIteration(int id, int v, int numProcs, const Partitioner& p, PredStore& predStore,
-    BoardMap&& boardMap, LoseFrontier&& loseFrontier, WinFrontier& winFrontier,
-    EndGameSet&& losses, const EndGameSet& wins, PredecessorGen predFn, SuccessorGen succFn)
+// receives the message status was probed for into recvBatch, unpacking it if batches are packed
+template <typename Transport, typename PredStore, typename CommData>
+void do_recvBatch(Transport& transport, const typename Transport::status_t& status, const PredStore& predStore, 
+    ::std::vector<unsigned char>& recvBytes, ::std::vector<CommData>& recvBatch)
 {
-  // TODO: See if finer grain parallelism can be employed with OpenMP (otherwise just launch more
-  // MPI processes)
+  // end of iteration messages are never packed
+  if (predStore.wireFormat() && transport.tag(status) == predStore.tag())
+  {
+    recvBytes.resize(transport.template count<unsigned char>(status));
+    transport.recv(recvBytes.data(), static_cast<int>(recvBytes.size()), status);
+    recvBatch.clear();
+    predStore.wireFormat()->unpack(recvBytes.data(), recvBytes.size(), recvBatch);
+    return;
+  }
+  recvBatch.resize(transport.template count<CommData>(status));
+  transport.recv(recvBatch.data(), static_cast<int>(recvBatch.size()), status);
+}
+
+/*
+ * Walks the entries [0, n) of a frontier on the OpenMP threads, calling walk(i, thread) for each. After every
+ * CLUSTER_POLL_CHUNK_SZ entries, the main thread sends the batches that filled up and receives the batches of
+ * the iteration that have already arrived, so communication overlaps the walk instead of following it, and 
+ * early batches do not pile up in the unexpected message queue of MPI. The predecessors of the current rank
+ * and those received are appended to staged. They only go to the next frontier once the iteration has 
+ * labelled all of its positions, as they would after the walk. Returns whether any predecessor was found.
+ *
+ * Only batches with the tag of the current iteration are received. The end of iteration messages are left
+ * to do_syncAndFree, and with CLUSTER_ALLTOALL, which sends nothing point to point, the walk is one chunk.
+ */
+template <typename CommData, typename Transport, typename PredStore, typename WalkFn>
+bool do_walkFrontier([[maybe_unused]] Transport& transport, int id, ::std::size_t n, thread_pred_buffers_t<CommData>& threadPreds,
+    PredStore& predStore, ::std::vector<CommData>& staged, WalkFn walk)
+{
+#ifdef CLUSTER_ALLTOALL
+  const ::std::size_t chunkSz = ::std::max<::std::size_t>(n, 1);
+#else
+  const ::std::size_t chunkSz = CLUSTER_POLL_CHUNK_SZ;
+#endif
   bool b_localAssignedWork = false;
-  ::std::vector<MPI_Request*> sendRequests;
+  ::std::vector<CommData> recvBatch;
+  ::std::vector<unsigned char> recvBytes;
 
-  for (auto& frontierState : winFrontier)
+#pragma omp parallel
   {
-    if (losses.find(frontierState.b) == losses.end() 
-        && wins.find(frontierState.b) == wins.end())
-    {      
-      // account for the fact that successors may have not been calculated
-      if (boardMap[frontierState.b].C < 0)
-      {
-        auto succs = succFn(frontierState.b);
-        boardMap[frontierState.b].C += succs.size();
-      }
-      short remainingPaths = boardMap[frontierState.b].C;
-      if (remainingPaths == 0)
-      {
-        auto preds = predFn(frontierState.b);
-        losses.insert(frontierState.b);
-        boardMap[frontierState.b].T = boardMap[frontierState.b].M;
+    int thread = omp_get_thread_num();
+    for (::std::size_t first = 0; first < n; first += chunkSz)
+    {
+      auto last = ::std::min(n, first + chunkSz);
+#pragma omp for schedule(static)
+      for (::std::size_t i = first; i < last; ++i)
+        walk(i, thread);
 
-        for (auto&& pred : preds)
+      // the loop ends with a barrier, so every thread is done with its buffers. Only the main thread calls MPI
+#pragma omp master
+      {
+        b_localAssignedWork |= do_dispatchPredecessors(id, threadPreds, predStore, staged);
+#ifndef CLUSTER_ALLTOALL
+        typename Transport::status_t status;
+        while (transport.iprobe(predStore.tag(), status))
         {
-          auto targetId = p(pred);
-          if (targetId == id)
-          {
-            auto [_, b_insert] = loseFrontier.insert({false, boardMap[frontierState.b].T, ::std::move(pred)});
-            if (b_insert)
-              b_localAssignedWork = true;
-          }
-          else
-          {
-            predStore.emplace_back(false, boardMap[frontierState.b].T, ::std::move(pred));
-            b_localAssignedWork = true;
-            MPI_Request* r = new MPI_Request();
-            sendRequests.push_back(r);
-            MPI_Isend(&(predStore.back()), 1, MPI_NodeCommData, targetId, 0, 
-              MPI_COMM_WORLD, r);
-          }
+          do_recvBatch(transport, status, predStore, recvBytes, recvBatch);
+          staged.insert(staged.end(), recvBatch.begin(), recvBatch.end());
         }
+#endif
       }
+#pragma omp barrier
     }
   }
-  // communicate finished message
-  for (int i = 0; i < numProcs; ++i)
+  return b_localAssignedWork;
+}
+
+// The major iteration of retrograde analysis. Win states are identified in this iteration
+template <typename Transport, typename WinFrontier, typename LoseFrontier, typename Partitioner, typename PredStore,
+  typename EndGameSet, typename PredecessorGen, typename BoardMap>
+inline auto do_majorIteration(Transport& transport, int id, short v, int numProcs, const Partitioner& p, 
+    PredStore& predStore, 
+    BoardMap&& boardMap, LoseFrontier& loseFrontier, WinFrontier&& winFrontier,
+    const EndGameSet& losses, EndGameSet&& wins, PredecessorGen predFn)
+{
+  using comm_data_t = typename LoseFrontier::value_type;
+  using board_t = typename EndGameSet::value_type;
+
+  auto threadPreds = makeThreadPredBuffers<comm_data_t>(numProcs);
+  ::std::vector<::std::vector<board_t>> threadWins(threadPreds.size());
+  ::std::vector<comm_data_t> staged;
+
+  // the frontier holds each board once, so the wins only need to be updated after the loop
+  bool b_localAssignedWork = do_walkFrontier(transport, id, loseFrontier.bucket_count(), threadPreds, predStore,
+      staged, [&](::std::size_t n, int thread)
   {
-    if (i != id)
+    for (auto it = loseFrontier.begin(n); it != loseFrontier.end(n); ++it)
     {
-      MPI_Request* r = new MPI_Request();
-      sendRequests.push_back(r);
-      
-      // if no board states, insert null board
-      if (winFrontier.empty())
-        winFrontier.insert({false, 0, { false, {}, {} }});
-      
-      if (b_localAssignedWork)
-      { 
-        MPI_Isend(&(*winFrontier.begin()), 1, MPI_NodeCommData, i, 1, // need to send a 1 if it is the last msg
-          MPI_COMM_WORLD, r);
-      }
-      else
+      const auto& frontierState = *it;
+      if (wins.find(frontierState.b) == wins.end())
       {
-        MPI_Isend(&(*winFrontier.begin()), 1, MPI_NodeCommData, i, 2, // need to send a 2 if it is the last msg
-          MPI_COMM_WORLD, r);
+        threadWins[thread].push_back(frontierState.b);
+        // tell the predecessor that the current state wins in v moves.
+        for (auto&& pred : predFn(frontierState.b))
+          threadPreds[thread][p(pred)].push_back({ true, v, ::std::move(pred) });
       }
     }
+  });
+  for (const auto& localWins : threadWins)
+    wins.insert(localWins.begin(), localWins.end());
+  do_processReceived<true>(v, staged, wins, losses, boardMap, winFrontier);
+
+#ifndef CLUSTER_ALLTOALL
+  predStore.flushAll();
+#endif
+#ifdef CLUSTER_END_OF_ITERATION_MSGS
+  // currently use null board. can be extended in the future to pack the last message
+  for (int i = 0; i < numProcs; ++i)
+  {
+    if (i != id)
+      predStore.sendEndOfIteration(i, b_localAssignedWork ? 1 : 2);
   }
-  return ::std::make_tuple(b_localAssignedWork, sendRequests, ::std::move(boardMap), 
-    ::std::move(loseFrontier), ::std::move(losses));
+#endif
+  return ::std::make_tuple(b_localAssignedWork, ::std::move(boardMap), ::std::move(winFrontier), 
+    ::std::move(wins));
+}
+
+// Performs the minor iteration of retrograde analysis where loss moves are identified
+template <typename Transport, typename WinFrontier, typename LoseFrontier, typename Partitioner, typename PredStore,
+  typename EndGameSet, typename PredecessorGen, typename SuccessorGen, typename BoardMap>
+inline auto do_minorIteration(Transport& transport, int id, int v, int numProcs, const Partitioner& p, 
+    PredStore& predStore,
+    BoardMap&& boardMap, LoseFrontier&& loseFrontier, WinFrontier& winFrontier,
+    EndGameSet&& losses, const EndGameSet& wins, PredecessorGen predFn, SuccessorGen succFn)
+{
+  using comm_data_t = typename WinFrontier::value_type;
+  using board_t = typename EndGameSet::value_type;
+
+  auto threadPreds = makeThreadPredBuffers<comm_data_t>(numProcs);
+  ::std::vector<::std::vector<board_t>> threadLosses(threadPreds.size());
+
+  // the estimate data of every unlabelled frontier state is created up front, since the threads below 
+  // may only look it up
+  ::std::vector<const comm_data_t*> candidates;
+  for (const auto& frontierState : winFrontier)
+  {
+    if (losses.find(frontierState.b) == losses.end() 
+        && wins.find(frontierState.b) == wins.end())
+    {
+      boardMap[frontierState.b];
+      candidates.push_back(&frontierState);
+    }
+  }
+
+  ::std::vector<comm_data_t> staged;
+  bool b_localAssignedWork = do_walkFrontier(transport, id, candidates.size(), threadPreds, predStore, staged,
+      [&](::std::size_t i, int thread)
+  {
+    const auto& frontierState = *candidates[i];
+    auto& estimateNodeData = boardMap.at(frontierState.b);
+    // account for the fact that successors may have not been calculated
+    if (estimateNodeData.C < 0)
+    {
+      auto succs = succFn(frontierState.b);
+      estimateNodeData.C += succs.size();
+    }
+    short remainingPaths = estimateNodeData.C;
+    if (remainingPaths == 0)
+    {
+      threadLosses[thread].push_back(frontierState.b);
+      estimateNodeData.T = estimateNodeData.M;
+
+      for (auto&& pred : predFn(frontierState.b))
+        threadPreds[thread][p(pred)].push_back({ false, estimateNodeData.T, ::std::move(pred) });
+    }
+  });
+  for (const auto& localLosses : threadLosses)
+    losses.insert(localLosses.begin(), localLosses.end());
+  do_processReceived<false>(static_cast<short>(v), staged, wins, losses, boardMap, loseFrontier);
+
+#ifndef CLUSTER_ALLTOALL
+  predStore.flushAll();
+#endif
+#ifdef CLUSTER_END_OF_ITERATION_MSGS
+  // communicate finished message
+  for (int i = 0; i < numProcs; ++i)
+  {
+    if (i != id)
+      predStore.sendEndOfIteration(i, b_localAssignedWork ? 1 : 2);
+  }
+#endif
+  return ::std::make_tuple(b_localAssignedWork, ::std::move(boardMap), ::std::move(loseFrontier), 
+    ::std::move(losses));
 }
 
 // TODO: Consider more efficient communication scheme with One-sided Communication 
 /*
  * The following function is the required synchronization routine performed at the end of
- * each major and minor iteration 
+ * each major and minor iteration. With CLUSTER_ALLTOALL defined, the predecessors buffered in predStore
+ * are exchanged with MPI_Alltoallv instead of being received message by message, and whether any rank 
+ * assigned work is reduced over all ranks.
+ *
+ * With CLUSTER_ASYNC_TERMINATION defined, there are neither end of iteration messages nor a barrier. A rank
+ * keeps receiving batches, and once all of its own synchronous sends have been matched, it joins a
+ * non-blocking reduction of whether any rank assigned work. The reduction completes once every rank has
+ * joined it, and then no batch of the iteration is left unreceived.
  */
-template<bool fromWinIteration, typename BoardMap, typename BoardSet, typename Frontier> 
-auto do_syncAndFree(int numNodes, short v,
-    ::std::vector<MPI_Request*> sendRequests,
+template<bool fromWinIteration, typename BoardMap, typename BoardSet, typename Frontier, typename PredStore,
+  typename Transport> 
+auto do_syncAndFree(Transport& transport, [[maybe_unused]] int numNodes, short v,
+    [[maybe_unused]] PredStore& predStore,
+    [[maybe_unused]] bool b_localAssignedWork,
     const BoardSet& wins,
     const BoardSet& losses,
     BoardMap&& boardMap, Frontier&& frontier)
 {
-  // initially, we only know that the current node is done with computation
-  int finishedNodes = 1;
+  using comm_data_t = typename ::std::remove_reference<decltype(frontier)>::type::value_type;
   bool b_otherAssignedWork = false;
 
-  typename ::std::remove_reference<decltype(frontier)>::type::value_type recvBuf;
-  // 1. Process all receives for the current node
-  do 
+#ifdef CLUSTER_ALLTOALL
+  // 1. Trade the number of predecessors for every pair of ranks, then the predecessors themselves. Packed
+  // batches are traded as bytes instead
+  const auto* wireFormat = predStore.wireFormat();
+  ::std::vector<int> sendCounts(numNodes);
+  ::std::vector<int> sendDispls(numNodes);
+  ::std::vector<comm_data_t> sendBatch;
+  ::std::vector<unsigned char> sendBytes;
+  for (int i = 0; i < numNodes; ++i)
   {
-    MPI_Status status;
-    MPI_Recv(&recvBuf, 1, MPI_NodeCommData, MPI_ANY_SOURCE,
-        MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-    
-    auto tag = status.MPI_TAG;
-
-    if (wins.find(recvBuf.b) == wins.end() 
-        && losses.find(recvBuf.b) == losses.end() && tag == 0)
+    const auto& pending = predStore.pending(i);
+    if (wireFormat)
     {
-      frontier.insert(recvBuf);
+      sendDispls[i] = static_cast<int>(sendBytes.size());
+      wireFormat->pack(pending.data(), pending.size(), sendBytes);
+      sendCounts[i] = static_cast<int>(sendBytes.size()) - sendDispls[i];
+      continue;
+    }
+    sendCounts[i] = static_cast<int>(pending.size());
+    sendDispls[i] = static_cast<int>(sendBatch.size());
+    sendBatch.insert(sendBatch.end(), pending.begin(), pending.end());
+  }
 
-      if constexpr (fromWinIteration)
-      {
-        // We initialize remaining moves to -1 and handle later. It is too 
-        // expensive to handle calculating successors here.
-        if (boardMap.find(recvBuf.b) == boardMap.end())
-        {
-          boardMap[recvBuf.b] = 
-            { 0, recvBuf.G, -1 }; 
-        }
-        // Decrement loss counter and determine current longest path to a loss
-        else
-        {
-          auto& estimateNodeData = boardMap[recvBuf.b];
-          --(estimateNodeData.C);
-          estimateNodeData.M = ::std::max(estimateNodeData.M, recvBuf.G);
-        }
-      }
-      else // from lose iteration
+  ::std::vector<int> recvCounts(numNodes);
+  ::std::vector<int> recvDispls(numNodes);
+  transport.alltoall(sendCounts.data(), recvCounts.data());
+  int recvTotal = 0;
+  for (int i = 0; i < numNodes; ++i)
+  {
+    recvDispls[i] = recvTotal;
+    recvTotal += recvCounts[i];
+  }
+
+  ::std::vector<comm_data_t> recvBatch;
+  if (wireFormat)
+  {
+    ::std::vector<unsigned char> recvBytes(recvTotal);
+    transport.alltoallv(sendBytes.data(), sendCounts.data(), sendDispls.data(),
+        recvBytes.data(), recvCounts.data(), recvDispls.data());
+    for (int i = 0; i < numNodes; ++i)
+      wireFormat->unpack(recvBytes.data() + recvDispls[i], recvCounts[i], recvBatch);
+  }
+  else
+  {
+    recvBatch.resize(recvTotal);
+    transport.alltoallv(sendBatch.data(), sendCounts.data(), sendDispls.data(),
+        recvBatch.data(), recvCounts.data(), recvDispls.data());
+  }
+  do_processReceived<fromWinIteration>(v, recvBatch, wins, losses, boardMap, frontier);
+
+  // 2. The iterations go on while any rank assigned work
+  b_otherAssignedWork = transport.allreduceOr(b_localAssignedWork);
+#elif defined(CLUSTER_ASYNC_TERMINATION)
+  ::std::vector<comm_data_t> recvBatch;
+  ::std::vector<unsigned char> recvBytes;
+  typename Transport::request_t reduceRequest;
+  bool b_joined = false;
+  bool b_done = false;
+  while (!b_done)
+  {
+    // 1. Process the batches that have arrived
+    typename Transport::status_t status;
+    if (transport.iprobe(predStore.tag(), status))
+    {
+      do_recvBatch(transport, status, predStore, recvBytes, recvBatch);
+      do_processReceived<fromWinIteration>(v, recvBatch, wins, losses, boardMap, frontier);
+    }
+    // 2. Free the sends that were matched, and join the reduction once all of them were
+    else if (!b_joined)
+    {
+      if (predStore.testAll())
       {
-        if (boardMap.find(recvBuf.b) == boardMap.end())
-          boardMap[recvBuf.b] = { static_cast<short>(v + 1), {}, {} }; // last two fields are only relevant to potentially lost states.  
-        else
-          boardMap[recvBuf.b].T = static_cast<short>(v + 1); 
+        transport.iallreduceOr(&b_localAssignedWork, &b_otherAssignedWork, &reduceRequest);
+        b_joined = true;
       }
     }
-    if (tag == 1) // consumed all work from sending node
+    // 3. Every rank has joined, so every batch has been received
+    else
+    {
+      b_done = transport.test(reduceRequest);
+    }
+  }
+#else
+  // initially, we only know that the current node is done with computation
+  int finishedNodes = 1;
+
+  ::std::vector<comm_data_t> recvBatch;
+  ::std::vector<unsigned char> recvBytes;
+  // 1. Process all receives for the current node. A single rank has nothing to receive
+  while (finishedNodes != numNodes)
+  {
+    // the size of a batch is only known once it arrives
+    typename Transport::status_t status;
+    transport.probe(status);
+    do_recvBatch(transport, status, predStore, recvBytes, recvBatch);
+    
+    auto tag = transport.tag(status);
+
+    if (tag == 0)
+      do_processReceived<fromWinIteration>(v, recvBatch, wins, losses, boardMap, frontier);
+    else if (tag == 1) // consumed all work from sending node
     {
       ++finishedNodes;
       b_otherAssignedWork = true;
@@ -351,19 +772,14 @@ auto do_syncAndFree(int numNodes, short v,
     {
       ++finishedNodes;
     }
-  } while(finishedNodes != numNodes);
-  
-  // 2. Wait for requests and free memory. All messages should be
-  // freed at this point. Cleanup resources.
-  for (::std::size_t i = 0; i < sendRequests.size(); ++i)
-  {
-    MPI_Status status;
-    MPI_Wait(sendRequests[i], &status);
-    delete sendRequests[i];
   }
+  
+  // 2. Wait for the sends to complete, which returns their slots to the pool
+  predStore.waitAll();
   // All nodes must synchronize here prior to ensure all messages have 
   // been consumed
-  MPI_Barrier(MPI_COMM_WORLD);
+  transport.barrier();
+#endif
   return ::std::make_tuple(::std::move(boardMap), ::std::move(frontier), b_otherAssignedWork);
 }
 
@@ -379,6 +795,17 @@ auto do_syncAndFree(int numNodes, short v,
 *
 * This below function is the internal implementation for the multi-node retrograde analysis implementation. Invoking
 * this function assumes an MPI installation on the system 
+*
+* Each board is processed by the rank the partitioner assigns it to, which may be any StateSpacePartition
+* with one part per rank (see state_space_partition.hpp).
+*
+* If a checkpoint is given, the state of the solver is saved at the end of its major and minor iterations,
+* and a checkpoint opened for resuming is loaded in place of the checkmates (see cluster_checkpoint.hpp).
+*
+* If a wire format is given, the predecessors sent between ranks are packed with it (see wire_format.hpp).
+*
+* The ranks communicate over MPI unless another transport is given, such as one rank of an in-process 
+* cluster (see cluster_transport.hpp). Checkpoints synchronize over MPI, so they need the MPI transport.
 */
 template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t N, 
   ::std::size_t rowSz, ::std::size_t colSz,
@@ -387,115 +814,149 @@ template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t
   typename ::std::enable_if<::std::is_base_of<GenerateForwardMoves<FlattenedSz, NonPlacementDataType>, 
     MoveGenerator>::value>::type* = nullptr,
   typename ::std::enable_if<::std::is_base_of<GenerateReverseMoves<FlattenedSz, NonPlacementDataType>, 
-    ReverseMoveGenerator>::value>::type* = nullptr>
-auto retrogradeAnalysisClusterImpl(const KStateSpacePartition<FlattenedSz, BoardState<FlattenedSz, NonPlacementDataType>>& partitioner, int id, 
+    ReverseMoveGenerator>::value>::type* = nullptr,
+  typename Partitioner,
+  typename ::std::enable_if<::std::is_base_of<StateSpacePartition<BoardState<FlattenedSz, NonPlacementDataType>>, 
+    Partitioner>::value>::type* = nullptr,
+  typename Transport=MpiTransport>
+auto retrogradeAnalysisClusterImpl(const Partitioner& partitioner, int id, 
     int numProcs, ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, 
       BoardStateHasher<FlattenedSz, NonPlacementDataType>>&& checkmates,
     MoveGenerator generateSuccessors,
     ReverseMoveGenerator generatePredecessors,
     HorizontalSymFn hzSymFn={}, VerticalSymFn vSymFn={}, 
-    IsValidBoardFn isValidBoardFn={})
+    IsValidBoardFn isValidBoardFn={},
+    ClusterCheckpoint* checkpoint=nullptr,
+    const PackedWireFormat<FlattenedSz, NodeCommData<FlattenedSz, NonPlacementDataType>>* wireFormat=nullptr,
+    Transport&& transport=Transport{})
 {
-  using board_set_t = ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, 
+  using board_set_t = FlatHashSet<BoardState<FlattenedSz, NonPlacementDataType>, 
     BoardStateHasher<FlattenedSz, NonPlacementDataType>>;
-  using frontier_t = ::std::unordered_set<NodeCommData<FlattenedSz, NonPlacementDataType>, 
+  using frontier_t = FlatHashSet<NodeCommData<FlattenedSz, NonPlacementDataType>, 
     NodeCommHasher<FlattenedSz, NonPlacementDataType>>;
-  using pred_list_t = ::std::list<NodeCommData<FlattenedSz, NonPlacementDataType>>;
+  using transport_t = ::std::remove_reference_t<Transport>;
+  using pred_list_t = PredecessorSendBuffers<NodeCommData<FlattenedSz, NonPlacementDataType>,
+    PackedWireFormat<FlattenedSz, NodeCommData<FlattenedSz, NonPlacementDataType>>, transport_t>;
   
   // Estimate data during search - more expensive than omp implementation 
   using board_map_t = 
-    ::std::unordered_map<BoardState<FlattenedSz, NonPlacementDataType>, 
+    FlatHashMap<BoardState<FlattenedSz, NonPlacementDataType>, 
     NodeEstimateData,
     BoardStateHasher<FlattenedSz, NonPlacementDataType>>;
 
+  // every board must belong to one of the ranks
+  assert(partitioner.numParts() == numProcs);
+  assert(transport.rank() == id && transport.size() == numProcs);
+  assert(!checkpoint || (::std::is_same_v<transport_t, MpiTransport>));
+
   board_set_t wins;
-  board_set_t losses = ::std::move(checkmates);
+  board_set_t losses;
   
   frontier_t winFrontier;
   frontier_t loseFrontier;
   
   board_map_t estimateData;
-  ::std::vector<MPI_Request*> sendRequests;
-  pred_list_t predList;
+  pred_list_t predList(transport, CLUSTER_SEND_BATCH_SZ, wireFormat);
+
+  bool b_otherAssignedWork{};
+  bool b_localAssignedWork{};
+
+  short firstV = 1;
+  // resuming after the major iteration of firstV skips to its minor iteration 
+  bool b_skipMajor = false;
+  if (checkpoint && checkpoint->resuming())
+  {
+    checkmates.clear();
+    auto [v, b_afterMajor] = checkpoint->restore(partitioner, wins, losses, estimateData, 
+      winFrontier, loseFrontier);
+    firstV = b_afterMajor ? v : v + 1;
+    b_skipMajor = b_afterMajor;
+  }
+  else
+  {
+    losses.insert(checkmates.begin(), checkmates.end());
+    checkmates.clear();
   
-  // 1. initialization 
-  for (const auto& l : losses)
-    winFrontier.insert({false, 0, l });
+    // 1. initialization 
+    for (const auto& l : losses)
+      winFrontier.insert({false, 0, l });
   
-  // 2. perform modified minor iteration for init sends
-  for (const auto& f : winFrontier)
-  {
-    auto preds = generatePredecessors(f.b);
-    for (auto&& pred : preds)
+    // 2. perform modified minor iteration for init sends
+    ::std::vector<NodeCommData<FlattenedSz, NonPlacementDataType>> localPreds;
+    for (const auto& f : winFrontier)
     {
-      auto targetId = partitioner(pred);
-      if (targetId != id) // different node processes this
-      {
-        predList.emplace_back(true, 0, ::std::move(pred));
-        MPI_Request* r = new MPI_Request();
-        MPI_Isend(&(predList.back()), 1, MPI_NodeCommData, targetId, 0, 
-              MPI_COMM_WORLD, r);
-      }
-      else
+      auto preds = generatePredecessors(f.b);
+      for (auto&& pred : preds)
       {
-        loseFrontier.insert({false, 0, pred });
+        auto targetId = partitioner(pred);
+        if (targetId != id) // different node processes this
+        {
+          predList.emplace(targetId, true, static_cast<short>(0), ::std::move(pred));
+        }
+        else
+        {
+          localPreds.push_back({false, 0, ::std::move(pred) });
+        }
       }
     }
-  }
-  for (int i = 0; i < numProcs; ++i)
-  {
-    if (i != id)
+    do_processReceived<false>(0, localPreds, wins, losses, estimateData, loseFrontier);
+#ifndef CLUSTER_ALLTOALL
+    predList.flushAll();
+#endif
+#ifdef CLUSTER_END_OF_ITERATION_MSGS
+    for (int i = 0; i < numProcs; ++i)
     {
-      MPI_Request* r = new MPI_Request();
-      sendRequests.push_back(r);
-      if (loseFrontier.empty())
-        loseFrontier.insert({false, 0, { false, {}, {} }});
-
-      MPI_Isend(&(*loseFrontier.begin()), 1, MPI_NodeCommData, i, 1, // need to send a 1 if it is the last msg
-        MPI_COMM_WORLD, r);
+      if (i != id)
+        predList.sendEndOfIteration(i, 1);
     }
-  }
+#endif
 
-  bool b_otherAssignedWork{};
-  bool b_localAssignedWork{};
-  ::std::tie(estimateData, loseFrontier, b_otherAssignedWork) = do_syncAndFree<false>(numProcs, 0, sendRequests,
-      wins, losses, ::std::move(estimateData), ::std::move(loseFrontier)); 
+    ::std::tie(estimateData, loseFrontier, b_otherAssignedWork) = do_syncAndFree<false>(transport, numProcs, 0,
+        predList, true, wins, losses, ::std::move(estimateData), ::std::move(loseFrontier)); 
 
-  winFrontier.clear();
-  sendRequests.clear();
-  predList.clear();
+    winFrontier.clear();
+    predList.clear();
+  }
 
-  for (short v = 1; v > 0; ++v)
+  for (short v = firstV; v > 0; ++v)
   {
-    // 1. Invoke major iteration
-    ::std::tie(b_localAssignedWork, sendRequests, estimateData, winFrontier, wins) = do_majorIteration(id, v, numProcs,
-        partitioner, predList, ::std::move(estimateData), loseFrontier, ::std::move(winFrontier), losses,
-        ::std::move(wins), generatePredecessors);
+    if (!b_skipMajor)
+    {
+      // 1. Invoke major iteration
+      ::std::tie(b_localAssignedWork, estimateData, winFrontier, wins) = do_majorIteration(transport, id, v, numProcs,
+          partitioner, predList, ::std::move(estimateData), loseFrontier, ::std::move(winFrontier), losses,
+          ::std::move(wins), generatePredecessors);
     
-    ::std::tie(estimateData, winFrontier, b_otherAssignedWork) = do_syncAndFree<true>(numProcs, v, sendRequests,
-        wins, losses, ::std::move(estimateData), ::std::move(winFrontier));
+      ::std::tie(estimateData, winFrontier, b_otherAssignedWork) = do_syncAndFree<true>(transport, numProcs, v,
+          predList, b_localAssignedWork, wins, losses, ::std::move(estimateData), ::std::move(winFrontier));
     
-    sendRequests.clear();
-    loseFrontier.clear();
-    predList.clear();
+      loseFrontier.clear();
+      predList.clear();
 
-    if (!b_otherAssignedWork && !b_localAssignedWork)
-      break;
+      if (!b_otherAssignedWork && !b_localAssignedWork)
+        break;
+
+      if (checkpoint)
+        checkpoint->save(v, true, wins, losses, estimateData, winFrontier);
+    }
+    b_skipMajor = false;
 
     // 2. Invoke minor iteration
-    ::std::tie(b_localAssignedWork, sendRequests, estimateData, loseFrontier, losses) = do_minorIteration(id, v, numProcs,
+    ::std::tie(b_localAssignedWork, estimateData, loseFrontier, losses) = do_minorIteration(transport, id, v, numProcs,
       partitioner, predList, ::std::move(estimateData), ::std::move(loseFrontier), winFrontier,
       ::std::move(losses), wins, generatePredecessors, generateSuccessors);
     
-    ::std::tie(estimateData, loseFrontier, b_otherAssignedWork) = do_syncAndFree<false>(numProcs, v, sendRequests, 
-        wins, losses, ::std::move(estimateData), ::std::move(loseFrontier));
+    ::std::tie(estimateData, loseFrontier, b_otherAssignedWork) = do_syncAndFree<false>(transport, numProcs, v,
+        predList, b_localAssignedWork, wins, losses, ::std::move(estimateData), ::std::move(loseFrontier));
 
-    sendRequests.clear();
     winFrontier.clear();
     predList.clear();
 
     if (!b_otherAssignedWork && !b_localAssignedWork)
       break; 
+
+    if (checkpoint)
+      checkpoint->save(v, false, wins, losses, estimateData, loseFrontier);
   }
   return ::std::make_tuple(wins, losses, estimateData);
 }
@@ -0,0 +1,225 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Cluster retrograde analysis over one-sided MPI communication. The positions are split with an
+ * IndexRangeStateSpacePartition into one contiguous slice of indices per rank, so a position's owner and its
+ * offset in the owner's slice follow from its index. Every rank exposes the status and remaining successor count of its slice
+ * through two MPI windows. Instead of shipping boards that the receiver must hash and insert, a rank labels
+ * a remote win or decrements a remote counter with one MPI_Accumulate. After each epoch, the owners find
+ * the positions that changed by scanning their slices in index order.
+ */
+
+#ifndef MULTI_NODE_RMA_IMPL_HPP_
+#define MULTI_NODE_RMA_IMPL_HPP_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include <mpi.h>
+
+#include "state.hpp"
+#include "state_transition.hpp"
+#include "result_store.hpp"
+#include "state_space_partition.hpp"
+
+/*
+ * A position's status word orders labels by the iteration that set them: 0 is unlabelled, and the word of
+ * a label set in iteration v is larger than the word of any label set after v. Remote wins are therefore
+ * applied with MPI_MAX and never replace an earlier label.
+ */
+using rma_status_t = ::std::int32_t;
+
+constexpr rma_status_t RMA_MAX_DEPTH = (1 << 29) - 1;
+
+constexpr rma_status_t rmaStatusWord(WDL wdl, int v)
+{
+  return ((RMA_MAX_DEPTH + 1 - v) << 1) | (wdl == WDL::WIN);
+}
+
+// Results of the positions owned by one rank
+struct RmaResultSlice
+{
+  position_index_t first;
+  ::std::vector<rma_status_t> status;
+
+  WDL wdl(position_index_t idx) const
+  {
+    auto s = status[idx - first];
+    if (s == 0)
+      return WDL::UNKNOWN;
+    return (s & 1) ? WDL::WIN : WDL::LOSS;
+  }
+
+  int depth(position_index_t idx) const { return RMA_MAX_DEPTH + 1 - (status[idx - first] >> 1); }
+
+  ::std::size_t numWins(void) const
+  {
+    ::std::size_t n = 0;
+    for (auto s : status)
+      n += s != 0 && (s & 1);
+    return n;
+  }
+
+  ::std::size_t numLosses(void) const
+  {
+    ::std::size_t n = 0;
+    for (auto s : status)
+      n += s != 0 && !(s & 1);
+    return n;
+  }
+};
+
+/*
+ * Follows the major and minor iterations of retrogradeAnalysisClusterImpl with the remaining successor
+ * counts of the SUCCESSOR_COUNTERS single node mode, so the minor iteration generates no successors once
+ * a position's count is known. A count starts at zero, is decremented remotely once per new win among the
+ * position's successors, and gets the position's number of successors added by the owner the first time it
+ * is seen to change. Each rank passes any subset of the checkmates, for instance those generatePartitionCheckmates
+ * finds for its slice; positions outside of the indexer's material signatures are not tracked.
+ */
+template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t N,
+  ::std::size_t rowSz, ::std::size_t colSz,
+  typename MoveGenerator, typename ReverseMoveGenerator,
+  typename ::std::enable_if<::std::is_base_of<GenerateForwardMoves<FlattenedSz, NonPlacementDataType>,
+    MoveGenerator>::value>::type* = nullptr,
+  typename ::std::enable_if<::std::is_base_of<GenerateReverseMoves<FlattenedSz, NonPlacementDataType>,
+    ReverseMoveGenerator>::value>::type* = nullptr>
+RmaResultSlice retrogradeAnalysisClusterRmaImpl(
+    const IndexRangeStateSpacePartition<FlattenedSz, NonPlacementDataType>& slices, int id, int numProcs,
+    const ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>>& checkmates,
+    MoveGenerator generateSuccessors,
+    ReverseMoveGenerator generatePredecessors)
+{
+  using board_t = BoardState<FlattenedSz, NonPlacementDataType>;
+  using counter_t = ::std::int32_t;
+
+  assert(slices.numParts() == numProcs);
+  const auto& indexer = slices.indexer();
+  auto first = slices.first(id);
+  auto sliceSz = slices.partSize(id);
+
+  rma_status_t* status = nullptr;
+  counter_t* counters = nullptr;
+  MPI_Win statusWin;
+  MPI_Win counterWin;
+  MPI_Win_allocate(slices.maxPartSize() * sizeof(rma_status_t), sizeof(rma_status_t), MPI_INFO_NULL,
+      MPI_COMM_WORLD, &status, &statusWin);
+  MPI_Win_allocate(slices.maxPartSize() * sizeof(counter_t), sizeof(counter_t), MPI_INFO_NULL,
+      MPI_COMM_WORLD, &counters, &counterWin);
+  ::std::fill(status, status + slices.maxPartSize(), 0);
+  ::std::fill(counters, counters + slices.maxPartSize(), 0);
+  // whether the owner has added a position's number of successors to its count
+  ::std::vector<bool> counted(sliceSz);
+
+  const rma_status_t minusOne = -1;
+  auto accumulate = [&](MPI_Win win, position_index_t idx, const ::std::int32_t& value, MPI_Op op)
+  {
+    MPI_Accumulate(&value, 1, MPI_INT32_T, slices.owner(idx), static_cast<MPI_Aint>(slices.offset(idx)),
+        1, MPI_INT32_T, op, win);
+  };
+  auto forEachPredecessor = [&](position_index_t idx, auto fn)
+  {
+    board_t b;
+    indexer.unrank(first + idx, b);
+    for (const auto& pred : generatePredecessors(b))
+    {
+      auto predIdx = indexer(pred);
+      if (predIdx != NULL_POSITION_INDEX)
+        fn(predIdx);
+    }
+  };
+  // ends the epoch of remote updates and keeps the next one from starting until the owners have scanned
+  auto scanSlice = [&](auto fn)
+  {
+    MPI_Win_fence(0, statusWin);
+    MPI_Win_fence(0, counterWin);
+    ::std::vector<position_index_t> labelled;
+    for (position_index_t i = 0; i < sliceSz; ++i)
+    {
+      if (fn(i))
+        labelled.push_back(i);
+    }
+    bool b_localAssignedWork = !labelled.empty();
+    bool b_assignedWork = false;
+    MPI_Allreduce(&b_localAssignedWork, &b_assignedWork, 1, MPI_C_BOOL, MPI_LOR, MPI_COMM_WORLD);
+    MPI_Win_fence(0, statusWin);
+    MPI_Win_fence(0, counterWin);
+    return ::std::make_pair(::std::move(labelled), b_assignedWork);
+  };
+
+  MPI_Win_fence(0, statusWin);
+  MPI_Win_fence(0, counterWin);
+
+  // 1. identify checkmate positions
+  const auto checkmateWord = rmaStatusWord(WDL::LOSS, 0);
+  for (const auto& l : checkmates)
+  {
+    auto idx = indexer(l);
+    if (idx != NULL_POSITION_INDEX)
+      accumulate(statusWin, idx, checkmateWord, MPI_MAX);
+  }
+  auto [losses, b_assignedWork] = scanSlice([&](position_index_t i) { return status[i] == checkmateWord; });
+
+  for (int v = 1; v > 0 && b_assignedWork; ++v)
+  {
+    // 2. Major iteration - the unlabelled predecessors of the new losses are wins in v moves
+    const auto winWord = rmaStatusWord(WDL::WIN, v);
+    for (auto i : losses)
+      forEachPredecessor(i, [&](position_index_t predIdx) { accumulate(statusWin, predIdx, winWord, MPI_MAX); });
+    ::std::vector<position_index_t> wins;
+    ::std::tie(wins, b_assignedWork) = scanSlice([&](position_index_t i) { return status[i] == winWord; });
+    if (!b_assignedWork)
+      break;
+
+    // 3. Minor iteration - a position whose successors have all become wins is lost in v moves
+    for (auto i : wins)
+      forEachPredecessor(i, [&](position_index_t predIdx) { accumulate(counterWin, predIdx, minusOne, MPI_SUM); });
+    const auto lossWord = rmaStatusWord(WDL::LOSS, v);
+    ::std::tie(losses, b_assignedWork) = scanSlice([&](position_index_t i)
+    {
+      if (status[i] != 0)
+        return false;
+      if (!counted[i])
+      {
+        // untouched so far
+        if (counters[i] == 0)
+          return false;
+        board_t b;
+        indexer.unrank(first + i, b);
+        counters[i] += static_cast<counter_t>(generateSuccessors(b).size());
+        counted[i] = true;
+      }
+      if (counters[i] != 0)
+        return false;
+      status[i] = lossWord;
+      return true;
+    });
+    if (id == 0)
+      ::std::cout << "done with v=" << v << ::std::endl;
+  }
+
+  RmaResultSlice result{ first, ::std::vector<rma_status_t>(status, status + sliceSz) };
+  MPI_Win_free(&counterWin);
+  MPI_Win_free(&statusWin);
+  return result;
+}
+
+#endif
@@ -0,0 +1,239 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Out-of-core single node retrograde analysis is provided in this header. The results are written into a
+ * DenseResultStore whose arrays live in files, and the frontiers are bitmaps over the same position
+ * indices, also kept in files. Every iteration streams through a frontier bitmap in index order. The
+ * predecessors found along the way are buffered in memory up to a fixed budget, sorted, and then written
+ * into the next frontier in one forward pass, so the random accesses of the search become mostly
+ * sequential passes over the files. Losses are found through a file of per-index successor counters that
+ * is updated in the same sorted passes, rather than by looking up the successors of every candidate.
+ */
+#ifndef OUT_OF_CORE_IMPL_HPP_
+#define OUT_OF_CORE_IMPL_HPP_
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include <omp.h>
+#include <unistd.h>
+
+#include "state_transition.hpp"
+#include "result_store.hpp"
+#include "mapped_array.hpp"
+
+struct OutOfCoreConfig
+{
+  // directory of the result and frontier files, preferably on a local disk
+  ::std::string dir;
+  // bytes of predecessor indices buffered in memory before they are written to a frontier
+  ::std::size_t memoryBudget;
+};
+
+using frontier_word_t = ::std::uint64_t;
+constexpr ::std::size_t POSITIONS_PER_FRONTIER_WORD = 8 * sizeof(frontier_word_t);
+
+// number of successors of a position that are not yet known to be wins, 0 if it has not been counted
+using successor_counter_t = ::std::uint16_t;
+
+// maps a zeroed scratch array of n elements. The file is unlinked right away
+template <typename T>
+MappedArray<T> do_makeScratchArray(const ::std::string& path, ::std::size_t n)
+{
+  MappedArray<T> arr(path, n);
+  ::unlink(path.c_str());
+  return arr;
+}
+
+// maps a zeroed frontier bitmap covering n positions
+inline auto makeFrontierBitmap(const ::std::string& path, position_index_t n)
+{
+  return do_makeScratchArray<frontier_word_t>(path, n / POSITIONS_PER_FRONTIER_WORD + 1);
+}
+
+/*
+ * Adds the buffered positions that are still unlabelled and for which admit(idx) returns true to the
+ * frontier, and empties the buffer
+ */
+template <typename ResultStore, typename AdmitFn>
+void do_flushPending(const ResultStore& store, ::std::vector<position_index_t>& pending,
+    MappedArray<frontier_word_t>& frontier, AdmitFn admit)
+{
+  // in index order, the status, counter and frontier pages are visited once each
+  ::std::sort(pending.begin(), pending.end());
+  for (auto idx : pending)
+  {
+    if (store.status(idx) != WDL::UNKNOWN || !admit(idx))
+      continue;
+    ::std::atomic_ref<frontier_word_t> word(frontier[idx / POSITIONS_PER_FRONTIER_WORD]);
+    word.fetch_or(frontier_word_t{1} << (idx % POSITIONS_PER_FRONTIER_WORD), ::std::memory_order_relaxed);
+  }
+  pending.clear();
+}
+
+/*
+ * Streams through the frontier in index order and clears it. visit(idx, pending) is called for every
+ * position in the frontier and appends the indices that may belong in the next frontier to pending, which
+ * are then filtered through admit as in do_flushPending. Returns true if any visit returned true.
+ */
+template <typename ResultStore, typename VisitFn, typename AdmitFn>
+bool do_streamFrontier(const ResultStore& store, MappedArray<frontier_word_t>& frontier,
+    MappedArray<frontier_word_t>& nextFrontier, ::std::size_t pendingCapacity, VisitFn visit, AdmitFn admit)
+{
+  bool b_update = false;
+#pragma omp parallel reduction(||:b_update)
+  {
+    ::std::vector<position_index_t> pending;
+    pending.reserve(pendingCapacity);
+
+#pragma omp for schedule(dynamic, 1024)
+    for (::std::size_t w = 0; w < frontier.size(); ++w)
+    {
+      auto bits = frontier[w];
+      if (!bits)
+        continue;
+      frontier[w] = 0;
+      for (; bits; bits &= bits - 1)
+      {
+        position_index_t idx = w * POSITIONS_PER_FRONTIER_WORD + ::std::countr_zero(bits);
+        if (visit(idx, pending))
+          b_update = true;
+        if (pending.size() >= pendingCapacity)
+          do_flushPending(store, pending, nextFrontier, admit);
+      }
+    }
+    do_flushPending(store, pending, nextFrontier, admit);
+  }
+  return b_update;
+}
+
+/*
+ * Out-of-core counterpart of retrogradeAnalysisBaseImpl in single_node_impl.hpp. It follows the same win
+ * and lose iterations, but the store must be a DenseResultStore (usually one constructed over files in
+ * config.dir) and positions are handled through their indices. Positions outside of the store's material
+ * signatures are not tracked. As with SUCCESSOR_COUNTERS, every position reached from a new win counts down
+ * its successors that are not yet wins, which relies on the reverse move generator producing exactly the
+ * inverse of the forward move generator. Requires compilation with OpenMP.
+ */
+template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t N,
+  ::std::size_t rowSz, ::std::size_t colSz,
+  typename MoveGenerator, typename ReverseMoveGenerator,
+  typename ::std::enable_if<::std::is_base_of<GenerateForwardMoves<FlattenedSz, NonPlacementDataType>,
+    MoveGenerator>::value>::type* = nullptr,
+  typename ::std::enable_if<::std::is_base_of<GenerateReverseMoves<FlattenedSz, NonPlacementDataType>,
+    ReverseMoveGenerator>::value>::type* = nullptr>
+void retrogradeAnalysisOutOfCoreImpl(DenseResultStore<FlattenedSz, NonPlacementDataType>& store,
+    const ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>>& checkmates,
+    MoveGenerator generateSuccessors,
+    ReverseMoveGenerator generatePredecessors,
+    const OutOfCoreConfig& config)
+{
+  using board_t = BoardState<FlattenedSz, NonPlacementDataType>;
+
+  const auto& indexer = store.indexer();
+  auto winFrontier = makeFrontierBitmap(config.dir + "/win_frontier.bin", indexer.size());
+  auto loseFrontier = makeFrontierBitmap(config.dir + "/lose_frontier.bin", indexer.size());
+  auto remainingSuccs = do_makeScratchArray<successor_counter_t>(config.dir + "/successor_counters.bin", 
+      indexer.size());
+
+  // the memory budget is split between the threads' buffers
+  auto pendingCapacity = ::std::max<::std::size_t>(1024,
+      config.memoryBudget / (omp_get_max_threads() * sizeof(position_index_t)));
+
+  auto appendPredecessors = [&](const board_t& b, ::std::vector<position_index_t>& pending)
+  {
+    for (const auto& pred : generatePredecessors(b))
+    {
+      auto idx = indexer(pred);
+      if (idx != NULL_POSITION_INDEX)
+        pending.push_back(idx);
+    }
+  };
+
+  auto admitAll = [](position_index_t) { return true; };
+
+  // counts down the successors of a position reached from a new win, which is a loss once none is left. 
+  // The count starts from all successors, so every win among them must reach the position exactly once
+  auto countWinSuccessor = [&](position_index_t idx)
+  {
+    ::std::atomic_ref<successor_counter_t> counter(remainingSuccs[idx]);
+    successor_counter_t expected = 0;
+    if (counter.load(::std::memory_order_relaxed) == 0)
+    {
+      board_t b;
+      indexer.unrank(idx, b);
+      auto numSuccs = generateSuccessors(b).size();
+      assert(numSuccs > 0 && numSuccs <= ::std::numeric_limits<successor_counter_t>::max());
+      // another thread may have counted the position first
+      counter.compare_exchange_strong(expected, static_cast<successor_counter_t>(numSuccs), 
+          ::std::memory_order_relaxed);
+    }
+    return counter.fetch_sub(1, ::std::memory_order_relaxed) == 1;
+  };
+
+  // 1. identify checkmate positions
+  ::std::vector<position_index_t> pending;
+  for (const auto& l : checkmates)
+  {
+    store.mark(indexer(l), WDL::LOSS, 0);
+    appendPredecessors(l, pending);
+  }
+  do_flushPending(store, pending, loseFrontier, admitAll);
+
+  for (int v = 1; v > 0; v++)
+  {
+    // 2. Win iteration - every unlabelled position of the lose frontier has a successor that is a loss
+    bool updateW = do_streamFrontier(store, loseFrontier, winFrontier, pendingCapacity,
+      [&](position_index_t idx, ::std::vector<position_index_t>& pending)
+      {
+        if (!store.mark(idx, WDL::WIN, v))
+          return false;
+        board_t b;
+        indexer.unrank(idx, b);
+        appendPredecessors(b, pending);
+        return true;
+      }, countWinSuccessor);
+
+    if (!updateW)
+      return;
+
+    // 3. Lose iteration - every unlabelled position of the win frontier has only successors that are wins
+    bool updateL = do_streamFrontier(store, winFrontier, loseFrontier, pendingCapacity,
+      [&](position_index_t idx, ::std::vector<position_index_t>& pending)
+      {
+        if (!store.mark(idx, WDL::LOSS, v))
+          return false;
+        board_t b;
+        indexer.unrank(idx, b);
+        appendPredecessors(b, pending);
+        return true;
+      }, admitAll);
+
+    std::cout << "done with v=" << v << std::endl;
+    if (!updateL)
+      return;
+  }
+}
+
+#endif
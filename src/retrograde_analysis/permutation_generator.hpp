@@ -24,9 +24,14 @@
 
 #include <vector>
 #include <array>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <limits>
 #include <type_traits>
 #include <algorithm>
 #include <numeric>
+#include <unordered_set>
 
 #include <omp.h>
 
@@ -41,6 +46,122 @@ struct false_fn
   bool operator()(const std::vector<unsigned char>& T) { return false; }
 };
 
+/*
+ * The placements of k pieces on distinct squares, that is the k-permutations of the FlattenedSz squares, in the
+ * lexicographic order of the squares of the pieces. This is the order of a next_permutation walk over all
+ * squares, but any placement can be reached from its index with unrank, and next only touches the squares of
+ * the k pieces. A range of indices can therefore be walked from any offset, so threads or ranks can split the
+ * placements into chunks of equal size. The square of the first piece is the most significant digit of the
+ * index.
+ */
+template <::std::size_t FlattenedSz>
+class KPermutation
+{
+  ::std::size_t m_k;
+  // number of placements of the pieces after piece i, once pieces [0, i] are placed
+  ::std::array<::std::uint64_t, FlattenedSz + 1> m_weights;
+  ::std::uint64_t m_size;
+  // square of each piece
+  ::std::array<::std::size_t, FlattenedSz> m_squares;
+  ::std::bitset<FlattenedSz> m_occupied;
+
+  // places pieces [i, k) on the lowest free squares in order
+  void fillFrom(::std::size_t i)
+  {
+    ::std::size_t sq = 0;
+    for (; i < m_k; ++i)
+    {
+      while (m_occupied[sq])
+        ++sq;
+      m_squares[i] = sq;
+      m_occupied.set(sq);
+    }
+  }
+
+public:
+  explicit KPermutation(::std::size_t k)
+    : m_k(k)
+  {
+    assert(k > 0 && k <= FlattenedSz);
+    m_weights[k - 1] = 1;
+    for (::std::size_t i = k - 1; i-- > 0; )
+    {
+      auto freeSquares = FlattenedSz - i - 1;
+      assert(m_weights[i + 1] <= ::std::numeric_limits<::std::uint64_t>::max() / freeSquares);
+      m_weights[i] = m_weights[i + 1] * freeSquares;
+    }
+    assert(m_weights[0] <= ::std::numeric_limits<::std::uint64_t>::max() / FlattenedSz);
+    m_size = m_weights[0] * FlattenedSz;
+    fillFrom(0);
+  }
+
+  // number of placements, FlattenedSz! / (FlattenedSz - k)!
+  ::std::uint64_t size(void) const { return m_size; }
+
+  ::std::size_t k(void) const { return m_k; }
+
+  // square of piece i
+  ::std::size_t operator[](::std::size_t i) const { return m_squares[i]; }
+
+  // moves to the placement of index idx
+  void unrank(::std::uint64_t idx)
+  {
+    assert(idx < m_size);
+    m_occupied.reset();
+    // the squares taken so far, in ascending order
+    ::std::array<::std::size_t, FlattenedSz> taken;
+    for (::std::size_t i = 0; i < m_k; ++i)
+    {
+      // piece i goes on the digit-th free square
+      ::std::size_t sq = idx / m_weights[i];
+      idx %= m_weights[i];
+      ::std::size_t pos = 0;
+      for (; pos < i && taken[pos] <= sq; ++pos)
+        ++sq;
+      ::std::copy_backward(taken.begin() + pos, taken.begin() + i, taken.begin() + i + 1);
+      taken[pos] = sq;
+      m_squares[i] = sq;
+      m_occupied.set(sq);
+    }
+  }
+
+  // index of the current placement
+  ::std::uint64_t index(void) const
+  {
+    ::std::uint64_t idx = 0;
+    for (::std::size_t i = 0; i < m_k; ++i)
+    {
+      ::std::size_t digit = m_squares[i];
+      for (::std::size_t j = 0; j < i; ++j)
+        digit -= m_squares[j] < m_squares[i];
+      idx += digit * m_weights[i];
+    }
+    return idx;
+  }
+
+  // moves to the next placement. After the last one, returns false and moves back to the first
+  bool next(void)
+  {
+    for (::std::size_t i = m_k; i-- > 0; )
+    {
+      m_occupied.reset(m_squares[i]);
+      // the pieces after i are lifted, so only the pieces before it are skipped
+      auto sq = m_squares[i] + 1;
+      while (sq < FlattenedSz && m_occupied[sq])
+        ++sq;
+      if (sq < FlattenedSz)
+      {
+        m_squares[i] = sq;
+        m_occupied.set(sq);
+        fillFrom(i + 1);
+        return true;
+      }
+    }
+    fillFrom(0);
+    return false;
+  }
+};
+
 // permutation generator functor. This exploits symmetry if present 
 template <::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t m_rowSz, ::std::size_t m_colSz, typename EvalFn, 
          typename HorizontalSymFn = false_fn, typename VerticalSymFn = false_fn, typename IsValidBoardFn = null_type>
@@ -75,27 +196,19 @@ public:
     EvalFn checkmateEval,
     IsValidBoardFn boardValidityEval = {})
   {
-    ::std::array<::std::size_t, FlattenedSz> indexPermutations;
-    ::std::iota(indexPermutations.begin(), indexPermutations.end(), 0);
-
     // generates kPermute new checkmate positions.
     for (::std::size_t kPermute = 3; kPermute != pieceSet.size() + 1; ++kPermute)
     {
-      // k-permutation iteration inspired by answer from Vaughn Cato last updated on May 23, 2017
-      // answer: https://stackoverflow.com/a/28712605
-      // author: https://stackoverflow.com/users/951890/vaughn-cato
+      KPermutation<FlattenedSz> placement(kPermute);
       do 
       {
         BoardState<FlattenedSz, NonPlacementDataType> currentBoard;
         for (::std::size_t i = 0; i != kPermute; ++i)
-          currentBoard.m_board[indexPermutations[i]] = pieceSet[i]; // scatter pieces
+          currentBoard.m_board[placement[i]] = pieceSet[i]; // scatter pieces
 
         if constexpr (!::std::is_same<null_type, IsValidBoardFn>::value)
           if (!boardValidityEval(currentBoard))
-          {
-            ::std::reverse(indexPermutations.begin() + kPermute, indexPermutations.end());
             continue;
-          }
         
         // checking if black loses (white wins) 
         if (checkmateEval(currentBoard))
@@ -110,9 +223,7 @@ public:
         {
           losses.insert(currentBoard);
         }
-
-        ::std::reverse(indexPermutations.begin() + kPermute, indexPermutations.end());
-      } while (::std::next_permutation(indexPermutations.begin(), indexPermutations.end()));
+      } while (placement.next());
     }
   }
   
@@ -0,0 +1,435 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Combinatorial position indexing is provided in this header. A material signature (the multiset
+ * of piece labels on the board) is mapped onto a dense range [0, size()) so that per-position data
+ * may be stored in flat arrays rather than in hash containers keyed by the full board state.
+ */
+
+#ifndef POSITION_INDEX_HPP_
+#define POSITION_INDEX_HPP_
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <concepts>
+#include <cstring>
+#include <unordered_map>
+
+#include "piece_label.hpp"
+#include "board_hash.hpp"
+
+using position_index_t = ::std::uint64_t;
+
+// returned when a board does not belong to any registered material signature
+constexpr position_index_t NULL_POSITION_INDEX = ::std::numeric_limits<position_index_t>::max();
+
+// largest number of identical pieces that may be grouped together in a single signature
+constexpr ::std::size_t MAX_GROUP_SZ = 16;
+
+// binomial coefficients C(n, k) for n <= FlattenedSz and k <= MAX_GROUP_SZ
+template <::std::size_t FlattenedSz>
+const auto& binomialTable()
+{
+  static const auto table = []
+  {
+    ::std::array<::std::array<position_index_t, MAX_GROUP_SZ + 1>, FlattenedSz + 1> c{};
+    for (::std::size_t n = 0; n <= FlattenedSz; ++n)
+    {
+      c[n][0] = 1;
+      for (::std::size_t k = 1; k <= ::std::min(n, MAX_GROUP_SZ); ++k)
+        c[n][k] = c[n-1][k-1] + (k <= n - 1 ? c[n-1][k] : 0);
+    }
+    return c;
+  }();
+  return table;
+}
+
+/*
+ * Perfect hash of all placements of a single material signature. Identical pieces are grouped
+ * together and each group is ranked as a combination over the squares left free by the groups
+ * before it, so no two indices describe the same position. Groups are ordered by first appearance
+ * in the pieceset, which makes the square of the first piece the most significant digit of the index
+ * (matching the KStateSpacePartition convention of tracking pieceSet[0]). The side to move is the
+ * least significant bit.
+ */
+template <::std::size_t FlattenedSz>
+class PositionIndexer
+{
+  // (label, number of pieces with this label)
+  ::std::vector<::std::pair<piece_label_t, ::std::size_t>> m_groups;
+  // number of distinct combinations for each group given the squares consumed by prior groups
+  ::std::vector<position_index_t> m_radix;
+  position_index_t m_size;
+  ::std::size_t m_numPieces;
+
+public:
+  PositionIndexer(const ::std::vector<piece_label_t>& pieceSet)
+    : m_size(2),
+      m_numPieces(pieceSet.size())
+  {
+    assert(pieceSet.size() <= FlattenedSz);
+    for (const auto& p : pieceSet)
+    {
+      auto it = ::std::find_if(m_groups.begin(), m_groups.end(),
+          [p](const auto& g) { return g.first == p; });
+      if (it == m_groups.end())
+        m_groups.emplace_back(p, 1);
+      else
+        ++(it->second);
+    }
+
+    const auto& c = binomialTable<FlattenedSz>();
+    ::std::size_t freeSquares = FlattenedSz;
+    for (const auto& [label, count] : m_groups)
+    {
+      assert(count <= MAX_GROUP_SZ);
+      m_radix.push_back(c[freeSquares][count]);
+      assert(m_size <= ::std::numeric_limits<position_index_t>::max() / m_radix.back());
+      m_size *= m_radix.back();
+      freeSquares -= count;
+    }
+  }
+
+  // number of indices (placements for both sides to move) of the signature
+  position_index_t size() const { return m_size; }
+
+  // size() of the signature pieceSet, or NULL_POSITION_INDEX if its indices would not fit a position_index_t
+  static position_index_t sizeOf(const ::std::vector<piece_label_t>& pieceSet)
+  {
+    if (pieceSet.size() > FlattenedSz)
+      return NULL_POSITION_INDEX;
+    ::std::vector<::std::pair<piece_label_t, ::std::size_t>> groups;
+    for (const auto& p : pieceSet)
+    {
+      auto it = ::std::find_if(groups.begin(), groups.end(), [p](const auto& g) { return g.first == p; });
+      if (it == groups.end())
+        groups.emplace_back(p, 1);
+      else
+        ++(it->second);
+    }
+
+    const auto& c = binomialTable<FlattenedSz>();
+    position_index_t sz = 2;
+    ::std::size_t freeSquares = FlattenedSz;
+    for (const auto& [label, count] : groups)
+    {
+      if (count > MAX_GROUP_SZ || sz >= NULL_POSITION_INDEX / c[freeSquares][count])
+        return NULL_POSITION_INDEX;
+      sz *= c[freeSquares][count];
+      freeSquares -= count;
+    }
+    return sz;
+  }
+
+  ::std::size_t numPieces() const { return m_numPieces; }
+
+  const auto& groups() const { return m_groups; }
+
+  // Assumes the board holds exactly the pieces of this signature
+  template <typename BoardType>
+  position_index_t rank(const BoardType& b) const
+  {
+    const auto& c = binomialTable<FlattenedSz>();
+    ::std::array<::std::size_t, FlattenedSz> occupied;
+    ::std::size_t numOccupied = 0;
+    position_index_t idx = 0;
+
+    for (::std::size_t g = 0; g < m_groups.size(); ++g)
+    {
+      const auto label = m_groups[g].first;
+      position_index_t digit = 0;
+      ::std::size_t k = 0;
+      ::std::size_t groupStart = numOccupied;
+
+      // squares are visited in ascending order, so the compressed squares are sorted
+      for (::std::size_t sq = 0; sq < FlattenedSz; ++sq)
+      {
+        if (b.m_board[sq] != label)
+          continue;
+
+        // compress the square by skipping the squares consumed by prior groups
+        ::std::size_t compressed = sq;
+        for (::std::size_t i = 0; i < groupStart; ++i)
+          if (occupied[i] < sq)
+            --compressed;
+
+        digit += c[compressed][++k];
+        occupied[numOccupied++] = sq;
+      }
+      assert(k == m_groups[g].second);
+      idx = idx * m_radix[g] + digit;
+    }
+    return idx * 2 + static_cast<position_index_t>(b.m_player);
+  }
+
+  // Places the signature's pieces onto an empty board corresponding to idx
+  template <typename BoardType>
+  void unrank(position_index_t idx, BoardType& b) const
+  {
+    assert(idx < m_size);
+    const auto& c = binomialTable<FlattenedSz>();
+    b.m_player = static_cast<bool>(idx & 1);
+    idx >>= 1;
+
+    ::std::vector<position_index_t> digits(m_groups.size());
+    for (::std::size_t g = m_groups.size(); g-- > 0; )
+    {
+      digits[g] = idx % m_radix[g];
+      idx /= m_radix[g];
+    }
+
+    // occupied squares are kept sorted so that decompression is a single forward pass
+    ::std::array<::std::size_t, FlattenedSz> occupied;
+    ::std::size_t numOccupied = 0;
+    ::std::size_t freeSquares = FlattenedSz;
+
+    for (::std::size_t g = 0; g < m_groups.size(); ++g)
+    {
+      const auto [label, count] = m_groups[g];
+      ::std::array<::std::size_t, MAX_GROUP_SZ> compressed;
+
+      // combinatorial number system: peel off the largest element first
+      auto rem = digits[g];
+      ::std::size_t n = freeSquares;
+      for (::std::size_t k = count; k > 0; --k)
+      {
+        do { --n; } while (c[n][k] > rem);
+        compressed[k-1] = n;
+        rem -= c[n][k];
+      }
+
+      ::std::size_t groupEnd = numOccupied;
+      for (::std::size_t k = 0; k < count; ++k)
+      {
+        // decompress by stepping over squares that are already occupied
+        ::std::size_t sq = compressed[k];
+        for (::std::size_t i = 0; i < groupEnd; ++i)
+          if (occupied[i] <= sq)
+            ++sq;
+        b.m_board[sq] = label;
+        occupied[numOccupied++] = sq;
+      }
+      ::std::sort(occupied.begin(), occupied.begin() + numOccupied);
+      freeSquares -= count;
+    }
+  }
+};
+
+// whether npd equals its value initialized default, which is what unrank leaves on a board
+template <typename NonPlacementDataType>
+bool isDefaultNonPlacementData(const NonPlacementDataType& npd)
+{
+  if constexpr (hasByteRepresentation<NonPlacementDataType>())
+  {
+    const NonPlacementDataType defaultData{};
+    return ::std::memcmp(&npd, &defaultData, sizeof(NonPlacementDataType)) == 0;
+  }
+  else if constexpr (::std::equality_comparable<NonPlacementDataType>)
+    return npd == NonPlacementDataType{};
+  else
+    return true;
+}
+
+// 4 bit counter slot of each label within a material key
+inline const auto& materialSlots()
+{
+  static const auto slots = []
+  {
+    ::std::array<int, 256> s;
+    s.fill(-1);
+    int nextSlot = 0;
+    for (const auto& pieces : { NON_ROYAL_PIECES, ROYAL_PIECES })
+      for (const auto& p : pieces)
+        if (s[p] == -1)
+          s[p] = nextSlot++;
+    assert(nextSlot <= 16);
+    return s;
+  }();
+  return slots;
+}
+
+/*
+ * Material key of a board: the piece count of every label packed into a single integer. Two boards
+ * share a key iff they hold the same multiset of pieces.
+ */
+inline void addToMaterialKey(::std::uint64_t& key, piece_label_t p)
+{
+  auto slot = materialSlots()[p];
+  // labels outside the piece tables have no slot, and a 16th piece of a label would carry into the next slot
+  assert(slot >= 0);
+  assert(((key >> (4 * slot)) & 0xF) != 0xF);
+  key += ::std::uint64_t{1} << (4 * slot);
+}
+
+inline ::std::uint64_t materialKeyOf(const ::std::vector<piece_label_t>& pieceSet)
+{
+  ::std::uint64_t key = 0;
+  for (const auto& p : pieceSet)
+    addToMaterialKey(key, p);
+  return key;
+}
+
+template <typename BoardType>
+::std::uint64_t materialKeyOf(const BoardType& b)
+{
+  ::std::uint64_t key = 0;
+  for (const auto& p : b.m_board)
+  {
+    if (!isEmpty(p))
+      addToMaterialKey(key, p);
+  }
+  return key;
+}
+
+// All sub-piecesets reachable from pieceSet through captures. Royal pieces are never captured.
+inline auto captureSignatures(const ::std::vector<piece_label_t>& pieceSet)
+{
+  ::std::vector<piece_label_t> royals;
+  ::std::vector<piece_label_t> capturable;
+  for (const auto& p : pieceSet)
+    (isRoyal(p) ? royals : capturable).push_back(p);
+
+  ::std::sort(capturable.begin(), capturable.end());
+  ::std::vector<::std::vector<piece_label_t>> signatures;
+
+  // walk every subset of the capturable pieces, skipping duplicate multisets
+  for (::std::size_t mask = 0; mask < (::std::size_t{1} << capturable.size()); ++mask)
+  {
+    bool isDuplicate = false;
+    for (::std::size_t i = 1; i < capturable.size(); ++i)
+    {
+      // among identical pieces, only the lowest ones may be selected
+      if (capturable[i] == capturable[i-1] && ((mask >> i) & 1) && !((mask >> (i-1)) & 1))
+        isDuplicate = true;
+    }
+    if (isDuplicate)
+      continue;
+
+    // preserve the original ordering so that pieceSet[0] stays the most significant digit
+    ::std::vector<piece_label_t> signature;
+    ::std::vector<bool> taken(capturable.size(), false);
+    for (const auto& p : pieceSet)
+    {
+      if (isRoyal(p))
+      {
+        signature.push_back(p);
+        continue;
+      }
+      for (::std::size_t i = 0; i < capturable.size(); ++i)
+      {
+        if (!taken[i] && capturable[i] == p)
+        {
+          taken[i] = true;
+          if ((mask >> i) & 1)
+            signature.push_back(p);
+          break;
+        }
+      }
+    }
+    signatures.push_back(::std::move(signature));
+  }
+  // largest signature first
+  ::std::stable_sort(signatures.begin(), signatures.end(),
+      [](const auto& x, const auto& y) { return x.size() > y.size(); });
+  return signatures;
+}
+
+/*
+ * Indexes the positions of several material signatures in one contiguous range. Each signature
+ * occupies [offset, offset + size) of the global index space.
+ */
+template <::std::size_t FlattenedSz>
+class MaterialIndexer
+{
+  ::std::vector<PositionIndexer<FlattenedSz>> m_indexers;
+  ::std::vector<position_index_t> m_offsets;
+  ::std::unordered_map<::std::uint64_t, ::std::size_t> m_signatureIds;
+  position_index_t m_size;
+
+public:
+  MaterialIndexer(const ::std::vector<::std::vector<piece_label_t>>& signatures)
+    : m_size(0)
+  {
+    for (const auto& s : signatures)
+    {
+      auto [_, b_insert] = m_signatureIds.emplace(materialKeyOf(s), m_indexers.size());
+      if (!b_insert)
+        continue;
+      m_indexers.emplace_back(s);
+      m_offsets.push_back(m_size);
+      m_size += m_indexers.back().size();
+    }
+  }
+
+  // registers the pieceset along with all of its captures
+  MaterialIndexer(const ::std::vector<piece_label_t>& pieceSet)
+    : MaterialIndexer(captureSignatures(pieceSet))
+  {
+  }
+
+  position_index_t size() const { return m_size; }
+
+  // whether the pieceset and all of its captures fit one index space
+  static bool indexable(const ::std::vector<piece_label_t>& pieceSet)
+  {
+    position_index_t total = 0;
+    for (const auto& s : captureSignatures(pieceSet))
+    {
+      auto sz = PositionIndexer<FlattenedSz>::sizeOf(s);
+      if (sz == NULL_POSITION_INDEX || total >= NULL_POSITION_INDEX - sz)
+        return false;
+      total += sz;
+    }
+    return true;
+  }
+
+  ::std::size_t numSignatures() const { return m_indexers.size(); }
+
+  const auto& indexer(::std::size_t signatureId) const { return m_indexers[signatureId]; }
+
+  position_index_t offset(::std::size_t signatureId) const { return m_offsets[signatureId]; }
+
+  // NULL_POSITION_INDEX if the board's material is not registered. Indices do not encode the non placement
+  // data, so boards whose non placement data is not the default have none either
+  template <typename BoardType>
+  position_index_t operator()(const BoardType& b) const
+  {
+    if (!isDefaultNonPlacementData(b.nonPlacementData))
+      return NULL_POSITION_INDEX;
+    auto it = m_signatureIds.find(materialKeyOf(b));
+    if (it == m_signatureIds.end())
+      return NULL_POSITION_INDEX;
+    return m_offsets[it->second] + m_indexers[it->second].rank(b);
+  }
+
+  // clears the board and writes the position of the given index into it
+  template <typename BoardType>
+  void unrank(position_index_t idx, BoardType& b) const
+  {
+    assert(idx < m_size);
+    auto signatureId = static_cast<::std::size_t>(::std::upper_bound(m_offsets.begin(), m_offsets.end(), idx)
+        - m_offsets.begin() - 1);
+    b = BoardType{};
+    m_indexers[signatureId].unrank(idx - m_offsets[signatureId], b);
+  }
+};
+
+#endif
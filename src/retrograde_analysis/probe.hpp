@@ -18,9 +18,11 @@
  * This header is utilized to probe a tablebase once stored in memory
  */
 #ifndef PROBE_HPP_
+#define PROBE_HPP_
 
 #include <vector>
 #include "state.hpp"
+#include "result_store.hpp"
 #include <iostream>
 
 /*
@@ -30,7 +32,8 @@
  *
  * The following probing function is to be invoked after a tablebase is generated. The function
  * returns the depth-to-mate depth along with a pathway from the original state to the checkmate state. 
- * Furthermore, the pathway is printed to the terminal with the BoardPrinter through execution
+ * Furthermore, the pathway is printed to the terminal with the BoardPrinter through execution.
+ * The depth-to-mate may be given as a board -> depth map or as one of the result stores in result_store.hpp
  */
 template<typename BoardType, typename MapType, typename SuccFn,
   typename BoardPrinter>
@@ -39,7 +42,7 @@ auto probe(const BoardType& b, const MapType& m, SuccFn succFn, bool isWinIterat
 {
   BoardType g = b;
   int depthToEnd = 0;
-  auto v = m.at(g);
+  auto v = lookupDepth(m, g).value();
   std::vector<BoardType> pathwayToEnd = {g};
   for (;;)
   {
@@ -50,9 +53,10 @@ auto probe(const BoardType& b, const MapType& m, SuccFn succFn, bool isWinIterat
     for (const auto& succ : succs)
     {
       // exploring a draw state
-      if (m.find(succ) == m.end())
+      auto succDepth = lookupDepth(m, succ);
+      if (!succDepth)
         continue;
-      auto lvlToEnd = m.at(succ);
+      auto lvlToEnd = *succDepth;
       // levels are doubled up per move
       if (isWinIteration && lvlToEnd == v - 1) 
       {
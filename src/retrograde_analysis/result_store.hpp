@@ -0,0 +1,249 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Result stores for the single node retrograde analysis are provided in this header. A result store
+ * records which positions are wins or losses for the side to move along with their depth-to-mate.
+ * The hash store keeps the wins, losses and depth-to-mate containers returned by retrogradeAnalysisBaseImpl.
+ * The dense store packs the same information into arrays indexed through a MaterialIndexer.
+ */
+
+#ifndef RESULT_STORE_HPP_
+#define RESULT_STORE_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "state.hpp"
+#include "sharded_hash_table.hpp"
+#include "position_index.hpp"
+#include "mapped_array.hpp"
+
+// result of a position for the side to move
+enum class WDL : ::std::uint8_t
+{
+  UNKNOWN = 0,
+  WIN     = 1,
+  LOSS    = 2,
+  DRAW    = 3
+};
+
+/*
+ * Wins, losses and depth-to-mate held in sharded open addressing hash containers. Boards that fall into
+ * different shards (see ShardedHashTable::shardIndex) may be marked and checked from separate threads.
+ */
+template <::std::size_t FlattenedSz, typename NonPlacementDataType>
+struct HashResultStore
+{
+  using board_t = BoardState<FlattenedSz, NonPlacementDataType>;
+  using board_set_t = ShardedHashSet<board_t, BoardStateHasher<FlattenedSz, NonPlacementDataType>>;
+  using board_map_t = ShardedHashMap<board_t, int, BoardStateHasher<FlattenedSz, NonPlacementDataType>>;
+
+  board_set_t wins;
+  board_set_t losses;
+  board_map_t depthToMate;
+
+  ::std::size_t numWins() const { return wins.size(); }
+  ::std::size_t numLosses() const { return losses.size(); }
+
+  // the position has not been labelled yet and may still be resolved
+  bool isCandidate(const board_t& b) const
+  {
+    return wins.find(b) == wins.end() && losses.find(b) == losses.end();
+  }
+
+  bool isWin(const board_t& b) const { return wins.find(b) != wins.end(); }
+
+  void markWin(const board_t& b, int v)
+  {
+    wins.insert(b);
+    depthToMate[b] = v;
+  }
+
+  void markLoss(const board_t& b, int v)
+  {
+    losses.insert(b);
+    depthToMate[b] = v;
+  }
+
+  ::std::optional<int> lookup(const board_t& b) const
+  {
+    auto it = depthToMate.find(b);
+    if (it == depthToMate.end())
+      return {};
+    return it->second;
+  }
+
+  WDL status(const board_t& b) const
+  {
+    if (isWin(b))
+      return WDL::WIN;
+    if (losses.find(b) != losses.end())
+      return WDL::LOSS;
+    return WDL::UNKNOWN;
+  }
+};
+
+/*
+ * Dense store of 2 bits of WDL and 8 bits of depth-to-mate per position. Depths that do not fit in
+ * 8 bits are kept in a small escape table. Marking distinct positions from separate threads is safe.
+ * Positions outside of the indexer's material signatures are not tracked. The arrays are held in memory,
+ * or in files of a given directory in index order for tablebases that do not fit in memory.
+ */
+template <::std::size_t FlattenedSz, typename NonPlacementDataType>
+class DenseResultStore
+{
+  using board_t = BoardState<FlattenedSz, NonPlacementDataType>;
+  using word_t = ::std::uint64_t;
+
+  // marks that the depth is held in the escape table
+  static constexpr ::std::uint8_t DTM_ESCAPE = 0xFF;
+  static constexpr ::std::size_t POSITIONS_PER_WORD = 4 * sizeof(word_t);
+
+  MaterialIndexer<FlattenedSz> m_indexer;
+  MappedArray<word_t> m_wdl;
+  MappedArray<::std::uint8_t> m_dtm;
+  ::std::unordered_map<position_index_t, int> m_dtmEscapes;
+  mutable ::std::mutex m_escapeMutex;
+  ::std::atomic<::std::size_t> m_numWins;
+  ::std::atomic<::std::size_t> m_numLosses;
+
+  void setDepth(position_index_t idx, int v)
+  {
+    if (v < DTM_ESCAPE)
+    {
+      m_dtm[idx] = static_cast<::std::uint8_t>(v);
+      return;
+    }
+    m_dtm[idx] = DTM_ESCAPE;
+    ::std::lock_guard<::std::mutex> lock(m_escapeMutex);
+    m_dtmEscapes[idx] = v;
+  }
+
+  // returns false if the position was already labelled
+  bool setStatus(position_index_t idx, WDL wdl)
+  {
+    ::std::atomic_ref<word_t> word(m_wdl[idx / POSITIONS_PER_WORD]);
+    auto shift = 2 * (idx % POSITIONS_PER_WORD);
+    auto prev = word.load(::std::memory_order_relaxed);
+    do
+    {
+      if (((prev >> shift) & 0x3) != static_cast<word_t>(WDL::UNKNOWN))
+        return false;
+    } while (!word.compare_exchange_weak(prev, prev | (static_cast<word_t>(wdl) << shift),
+          ::std::memory_order_relaxed));
+    return true;
+  }
+
+public:
+  DenseResultStore(MaterialIndexer<FlattenedSz> indexer)
+    : m_indexer(::std::move(indexer)),
+      m_wdl(m_indexer.size() / POSITIONS_PER_WORD + 1),
+      m_dtm(m_indexer.size()),
+      m_numWins(0),
+      m_numLosses(0)
+  {
+  }
+
+  // keeps the arrays in the files wdl.bin and dtm.bin of dir, overwriting them
+  DenseResultStore(MaterialIndexer<FlattenedSz> indexer, const ::std::string& dir)
+    : m_indexer(::std::move(indexer)),
+      m_wdl(dir + "/wdl.bin", m_indexer.size() / POSITIONS_PER_WORD + 1),
+      m_dtm(dir + "/dtm.bin", m_indexer.size()),
+      m_numWins(0),
+      m_numLosses(0)
+  {
+  }
+
+  const auto& indexer() const { return m_indexer; }
+
+  position_index_t size() const { return m_indexer.size(); }
+
+  ::std::size_t numWins() const { return m_numWins; }
+  ::std::size_t numLosses() const { return m_numLosses; }
+
+  WDL status(position_index_t idx) const
+  {
+    // atomic_ref only views mutable objects, but the load does not write
+    auto& word = const_cast<word_t&>(m_wdl[idx / POSITIONS_PER_WORD]);
+    auto wordBits = ::std::atomic_ref<word_t>(word).load(::std::memory_order_relaxed);
+    return static_cast<WDL>((wordBits >> (2 * (idx % POSITIONS_PER_WORD))) & 0x3);
+  }
+
+  WDL status(const board_t& b) const
+  {
+    auto idx = m_indexer(b);
+    return idx == NULL_POSITION_INDEX ? WDL::UNKNOWN : status(idx);
+  }
+
+  int depth(position_index_t idx) const
+  {
+    if (m_dtm[idx] != DTM_ESCAPE)
+      return m_dtm[idx];
+    ::std::lock_guard<::std::mutex> lock(m_escapeMutex);
+    return m_dtmEscapes.at(idx);
+  }
+
+  bool isCandidate(const board_t& b) const
+  {
+    auto idx = m_indexer(b);
+    return idx != NULL_POSITION_INDEX && status(idx) == WDL::UNKNOWN;
+  }
+
+  bool isWin(const board_t& b) const { return status(b) == WDL::WIN; }
+
+  void markWin(const board_t& b, int v) { mark(m_indexer(b), WDL::WIN, v); }
+
+  void markLoss(const board_t& b, int v) { mark(m_indexer(b), WDL::LOSS, v); }
+
+  // returns false if the position is not tracked or was already labelled
+  bool mark(position_index_t idx, WDL wdl, int v)
+  {
+    if (idx == NULL_POSITION_INDEX || !setStatus(idx, wdl))
+      return false;
+    setDepth(idx, v);
+    ++(wdl == WDL::WIN ? m_numWins : m_numLosses);
+    return true;
+  }
+
+  ::std::optional<int> lookup(const board_t& b) const
+  {
+    auto idx = m_indexer(b);
+    if (idx == NULL_POSITION_INDEX || status(idx) == WDL::UNKNOWN)
+      return {};
+    return depth(idx);
+  }
+};
+
+// depth-to-mate lookup shared by the result stores and plain board -> depth maps
+template <typename MapType, typename BoardType>
+::std::optional<int> lookupDepth(const MapType& m, const BoardType& b)
+{
+  if constexpr (requires { m.lookup(b); })
+    return m.lookup(b);
+  else
+  {
+    auto it = m.find(b);
+    if (it == m.end())
+      return {};
+    return it->second;
+  }
+}
+
+#endif
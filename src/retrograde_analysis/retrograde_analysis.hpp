@@ -30,8 +30,10 @@
 
 #ifdef MULTI_NODE
 # include "multi_node_impl.hpp"
+# include "multi_node_rma_impl.hpp"
 #else
 # include "single_node_impl.hpp"
+# include "out_of_core_impl.hpp"
 #endif
 
 // used to deduce implementation to invoke at compile time
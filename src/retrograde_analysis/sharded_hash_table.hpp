@@ -0,0 +1,223 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Hash set and map split into a fixed number of flat hash table shards by the high bits of the key's hash.
+ * The shard of a key only depends on the key and the hasher, so containers of the same key type and hasher
+ * agree on it. Different shards may be written from different threads at the same time, which lets the
+ * OpenMP solver merge its thread local results by giving each thread whole shards instead of serializing the
+ * merge behind a critical section.
+ */
+
+#ifndef SHARDED_HASH_TABLE_HPP_
+#define SHARDED_HASH_TABLE_HPP_
+
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "flat_hash_table.hpp"
+
+template <typename Table, ::std::size_t ShardBits = 8>
+class ShardedHashTable
+{
+public:
+  using key_type = typename Table::key_type;
+  using value_type = typename Table::value_type;
+  using size_type = ::std::size_t;
+  using hasher = typename Table::hasher;
+  using shard_type = Table;
+
+  static constexpr size_type NUM_SHARDS = size_type(1) << ShardBits;
+
+private:
+  ::std::vector<Table> m_shards;
+  [[no_unique_address]] hasher m_hash;
+
+  // the shard tables index their slots with the low bits of the hash, so shards are chosen with the high bits
+  static size_type shardOfHash(::std::uint64_t h)
+  {
+    return static_cast<size_type>((h * 0xbf58476d1ce4e5b9ull) >> (64 - ShardBits));
+  }
+
+  template <bool IsConst>
+  class Iterator
+  {
+    friend class ShardedHashTable;
+    using shards_ptr = ::std::conditional_t<IsConst, const ::std::vector<Table>*, ::std::vector<Table>*>;
+    using inner_t = ::std::conditional_t<IsConst, typename Table::const_iterator, typename Table::iterator>;
+
+    shards_ptr m_shards;
+    size_type m_shard;
+    inner_t m_it;
+
+    void skipEmpty()
+    {
+      while (m_shard < NUM_SHARDS && m_it == (*m_shards)[m_shard].end())
+        if (++m_shard < NUM_SHARDS)
+          m_it = (*m_shards)[m_shard].begin();
+    }
+
+  public:
+    using iterator_category = ::std::forward_iterator_tag;
+    using value_type = typename ::std::iterator_traits<inner_t>::value_type;
+    using difference_type = ::std::ptrdiff_t;
+    using pointer = typename ::std::iterator_traits<inner_t>::pointer;
+    using reference = typename ::std::iterator_traits<inner_t>::reference;
+
+    Iterator() : m_shards(nullptr), m_shard(NUM_SHARDS), m_it() {}
+    Iterator(shards_ptr shards, size_type shard, inner_t it) : m_shards(shards), m_shard(shard), m_it(it) {}
+
+    template <bool OtherConst, typename = ::std::enable_if_t<IsConst && !OtherConst>>
+    Iterator(const Iterator<OtherConst>& other) : m_shards(other.m_shards), m_shard(other.m_shard), m_it(other.m_it) {}
+
+    reference operator*() const { return *m_it; }
+    pointer operator->() const { return &*m_it; }
+
+    Iterator& operator++()
+    {
+      ++m_it;
+      skipEmpty();
+      return *this;
+    }
+
+    Iterator operator++(int)
+    {
+      auto prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    bool operator==(const Iterator& other) const
+    {
+      return m_shard == other.m_shard && (m_shard == NUM_SHARDS || m_it == other.m_it);
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+    template <bool> friend class Iterator;
+  };
+
+  static constexpr bool IS_SET = ::std::is_same_v<typename Table::iterator, typename Table::const_iterator>;
+
+public:
+  using const_iterator = Iterator<true>;
+  using iterator = ::std::conditional_t<IS_SET, const_iterator, Iterator<false>>;
+
+  ShardedHashTable() : m_shards(NUM_SHARDS) {}
+
+  template <typename InputIt>
+  ShardedHashTable(InputIt first, InputIt last)
+    : ShardedHashTable()
+  {
+    insert(first, last);
+  }
+
+  size_type shardIndex(const key_type& key) const { return shardOfHash(m_hash(key)); }
+
+  Table& shard(size_type i) { return m_shards[i]; }
+  const Table& shard(size_type i) const { return m_shards[i]; }
+
+  iterator begin()
+  {
+    iterator it(&m_shards, 0, m_shards[0].begin());
+    it.skipEmpty();
+    return it;
+  }
+  iterator end() { return iterator(); }
+
+  const_iterator begin() const
+  {
+    const_iterator it(&m_shards, 0, m_shards[0].begin());
+    it.skipEmpty();
+    return it;
+  }
+  const_iterator end() const { return const_iterator(); }
+
+  bool empty() const { return size() == 0; }
+
+  size_type size() const
+  {
+    size_type sz = 0;
+    for (const auto& s : m_shards)
+      sz += s.size();
+    return sz;
+  }
+
+  void clear()
+  {
+    for (auto& s : m_shards)
+      s.clear();
+  }
+
+  template <typename V>
+  ::std::pair<iterator, bool> insert(V&& value)
+  {
+    auto hash = m_hash(Table::policy_type::key(value));
+    auto i = shardOfHash(hash);
+    auto [it, inserted] = m_shards[i].insertHashed(::std::forward<V>(value), hash);
+    return { iterator(&m_shards, i, it), inserted };
+  }
+
+  ::std::pair<iterator, bool> insert(const value_type& value) { return insert<const value_type&>(value); }
+  ::std::pair<iterator, bool> insert(value_type&& value) { return insert<value_type>(::std::move(value)); }
+
+  template <typename InputIt>
+  void insert(InputIt first, InputIt last)
+  {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  iterator find(const key_type& key)
+  {
+    auto hash = m_hash(key);
+    auto i = shardOfHash(hash);
+    auto it = m_shards[i].findHashed(key, hash);
+    return it == m_shards[i].end() ? end() : iterator(&m_shards, i, it);
+  }
+
+  const_iterator find(const key_type& key) const
+  {
+    auto hash = m_hash(key);
+    auto i = shardOfHash(hash);
+    auto it = m_shards[i].findHashed(key, hash);
+    return it == m_shards[i].end() ? end() : const_iterator(&m_shards, i, it);
+  }
+
+  bool contains(const key_type& key) const { return find(key) != end(); }
+  size_type count(const key_type& key) const { return contains(key); }
+
+  size_type erase(const key_type& key) { return m_shards[shardIndex(key)].erase(key); }
+};
+
+template <typename Key, typename Hash = ::std::hash<Key>, typename KeyEqual = ::std::equal_to<Key>>
+using ShardedHashSet = ShardedHashTable<FlatHashSet<Key, Hash, KeyEqual>>;
+
+template <typename Key, typename T, typename Hash = ::std::hash<Key>, typename KeyEqual = ::std::equal_to<Key>>
+class ShardedHashMap : public ShardedHashTable<FlatHashMap<Key, T, Hash, KeyEqual>>
+{
+  using base_t = ShardedHashTable<FlatHashMap<Key, T, Hash, KeyEqual>>;
+
+public:
+  using mapped_type = T;
+  using base_t::base_t;
+
+  T& operator[](const Key& key) { return this->shard(this->shardIndex(key))[key]; }
+  T& at(const Key& key) { return this->shard(this->shardIndex(key)).at(key); }
+  const T& at(const Key& key) const { return this->shard(this->shardIndex(key)).at(key); }
+};
+
+#endif
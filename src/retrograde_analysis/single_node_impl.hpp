@@ -28,9 +28,16 @@
 #include <tuple>
 #include <unordered_map>
 #include <deque>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
 
 #include "state_transition.hpp"
 #include "checkmate_generation.hpp"
+#include "result_store.hpp"
+#include "sharded_hash_table.hpp"
+#include "mapped_array.hpp"
+#include "checkpoint.hpp"
 
 #ifdef TRACK_RETROGRADE_ANALYSIS
 // helper function when tracking board win states
@@ -82,6 +89,82 @@ void print_loss(auto l, int v)
 
 #endif
 
+/*
+ * Number of successors of each reached position that are not yet known to be wins, used with
+ * SUCCESSOR_COUNTERS. Stores with a MaterialIndexer keep one 16 bit counter per index, where 0 marks a
+ * position without a counter. A reached position always has a successor that is not yet a win, the loss 
+ * it was reached from. Other stores keep a sharded map, sharded like the frontiers, whose entries are 
+ * dropped once their position is labelled. Threads may update distinct shards at once.
+ */
+template <typename BoardType, typename Hasher, typename ResultStore>
+class SuccessorCounters
+{
+  static constexpr bool BY_INDEX = requires (const ResultStore& s) { s.indexer(); };
+  using counter_t = ::std::uint16_t;
+  using counters_t = ::std::conditional_t<BY_INDEX, MappedArray<counter_t>, 
+    ShardedHashMap<BoardType, int, Hasher>>;
+
+  const ResultStore& m_store;
+  counters_t m_counters;
+
+  static counters_t makeCounters(const ResultStore& store)
+  {
+    if constexpr (BY_INDEX)
+      return MappedArray<counter_t>(store.indexer().size());
+    else
+      return {};
+  }
+
+public:
+  explicit SuccessorCounters(const ResultStore& store)
+    : m_store(store), m_counters(makeCounters(store))
+  {
+  }
+
+  // whether the candidate position b in shard s has a counter
+  bool contains(::std::size_t s, const BoardType& b) const
+  {
+    if constexpr (BY_INDEX)
+      return m_counters[m_store.indexer()(b)] != 0;
+    else
+      return m_counters.shard(s).contains(b);
+  }
+
+  // decrements the counter of the candidate position b in shard s, first setting it to numSuccs if b has 
+  // none. Returns true once no successor is left that is not a win
+  bool decrement(::std::size_t s, const BoardType& b, int numSuccs)
+  {
+    if constexpr (BY_INDEX)
+    {
+      auto& counter = m_counters[m_store.indexer()(b)];
+      if (counter == 0)
+      {
+        assert(numSuccs > 0 && numSuccs <= ::std::numeric_limits<counter_t>::max());
+        counter = static_cast<counter_t>(numSuccs);
+      }
+      return --counter == 0;
+    }
+    else
+    {
+      auto& counters = m_counters.shard(s);
+      auto it = counters.find(b);
+      if (it == counters.end())
+        it = counters.insert({ b, numSuccs }).first;
+      if (--(it->second) != 0)
+        return false;
+      counters.erase(b);
+      return true;
+    }
+  }
+
+  // drops the counter of the position b in shard s once it is labelled
+  void erase(::std::size_t s, const BoardType& b)
+  {
+    if constexpr (!BY_INDEX)
+      m_counters.shard(s).erase(b);
+  }
+};
+
 /*
  * Technique for ensuring that a type extends a separate type in the below function templating
  * found in the following answer by 'AndyG' last updated June 7th, 2015
@@ -89,7 +172,14 @@ void print_loss(auto l, int v)
  * author: https://stackoverflow.com/users/27678/andyg 
  *
  * This function is the internal base implementation for the single-node implementation and requires
- * compilation with OpenMP.
+ * compilation with OpenMP. Results are written into the given result store (see result_store.hpp).
+ *
+ * With SUCCESSOR_COUNTERS defined, each reached position keeps a count of its successors that are not
+ * yet wins, decremented whenever it is generated as the predecessor of a new win. A position becomes a
+ * loss when its count reaches zero, so the lose iteration does no forward move generation.
+ *
+ * If a checkpoint log is given, the positions labelled in each iteration are appended to it, and a log
+ * opened for resuming is first replayed into the store (see checkpoint.hpp).
  */
 template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t N, 
   ::std::size_t rowSz, ::std::size_t colSz,
@@ -98,85 +188,154 @@ template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t
   typename ::std::enable_if<::std::is_base_of<GenerateForwardMoves<FlattenedSz, NonPlacementDataType>, 
     MoveGenerator>::value>::type* = nullptr,
   typename ::std::enable_if<::std::is_base_of<GenerateReverseMoves<FlattenedSz, NonPlacementDataType>, 
-    ReverseMoveGenerator>::value>::type* = nullptr>
-auto retrogradeAnalysisBaseImpl(::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>> checkmates,
+    ReverseMoveGenerator>::value>::type* = nullptr,
+  typename ResultStore>
+void retrogradeAnalysisBaseImpl(ResultStore& store,
+    ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>> checkmates,
     MoveGenerator generateSuccessors,
     ReverseMoveGenerator generatePredecessors,
     HorizontalSymFn hzSymFn={}, VerticalSymFn vSymFn={}, 
-    IsValidBoardFn isValidBoardFn={})
+    IsValidBoardFn isValidBoardFn={},
+    CheckpointLog<BoardState<FlattenedSz, NonPlacementDataType>, ResultStore>* checkpoint=nullptr)
 {
-  using board_set_t = ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, 
-        BoardStateHasher<FlattenedSz, NonPlacementDataType>>;
-  
   using local_frontier_t = ::std::vector<BoardState<FlattenedSz, NonPlacementDataType>>;
-  using frontier_t = ::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, 
-    BoardStateHasher<FlattenedSz, NonPlacementDataType>>;
-  using board_map_t = ::std::unordered_map<BoardState<FlattenedSz, NonPlacementDataType>, int, 
+  using frontier_t = ShardedHashSet<BoardState<FlattenedSz, NonPlacementDataType>, 
     BoardStateHasher<FlattenedSz, NonPlacementDataType>>;
+  // thread local boards grouped by the frontier shard they belong to
+  using shard_buffers_t = ::std::vector<local_frontier_t>;
 
-  auto numThreads = omp_get_num_threads();
+  auto numThreads = omp_get_max_threads();
+  ::std::vector<shard_buffers_t> threadPreds(numThreads, shard_buffers_t(frontier_t::NUM_SHARDS));
+  ::std::vector<shard_buffers_t> threadLabels(numThreads, shard_buffers_t(frontier_t::NUM_SHARDS));
+  // positions labelled in the current iteration, by shard, when checkpointing
+  shard_buffers_t newWins;
+  shard_buffers_t newLosses;
 
   // 1. identify checkmate positions 
-  board_set_t wins;
-  board_set_t losses = ::std::move(checkmates);
-  
   frontier_t winFrontier;
   frontier_t loseFrontier;
-  
-  // T(p) : BoardState -> int
-  board_map_t depthToMate;
-  for (const auto& l : losses)
+#ifdef SUCCESSOR_COUNTERS
+  SuccessorCounters<BoardState<FlattenedSz, NonPlacementDataType>, 
+    BoardStateHasher<FlattenedSz, NonPlacementDataType>, ResultStore> remainingSuccs(store);
+  // for each buffered predecessor, its number of successors that were not wins before the current 
+  // iteration, or 0 if it already has a counter
+  ::std::vector<::std::vector<::std::vector<int>>> threadPredSuccs(numThreads, 
+      ::std::vector<::std::vector<int>>(frontier_t::NUM_SHARDS));
+#endif
+
+  int firstV = 0;
+  if (checkpoint && checkpoint->resuming())
+  {
+    // the lose frontier following the last checkpointed iteration holds the unlabelled predecessors 
+    // of the positions lost in it
+    auto [lastV, lastLosses] = checkpoint->restore(store);
+    for (const auto& l : lastLosses)
+    {
+      for (const auto& pred : generatePredecessors(l))
+      {
+        if (store.isCandidate(pred))
+          loseFrontier.insert(pred);
+      }
+    }
+    firstV = lastV + 1;
+  }
+
+  if (firstV == 0)
   {
-    auto preds = generatePredecessors(l);
-    loseFrontier.insert(::std::begin(preds), ::std::end(preds)); 
-    depthToMate[l] = 0;
+    // T(p) : BoardState -> int
+    for (const auto& l : checkmates)
+    {
+      auto preds = generatePredecessors(l);
+      loseFrontier.insert(::std::begin(preds), ::std::end(preds)); 
+      store.markLoss(l, 0);
+    }
+    if (checkpoint)
+      checkpoint->append(store, 0, {}, { local_frontier_t(checkmates.begin(), checkmates.end()) });
+    firstV = 1;
   }
   
-  for(int v = 1; v > 0; v++) {
+  for(int v = firstV; v > 0; v++) {
+    if (checkpoint)
+    {
+      newWins.assign(frontier_t::NUM_SHARDS, {});
+      newLosses.assign(frontier_t::NUM_SHARDS, {});
+    }
     // 2. Win iteration - add immediate wins (at least one successor is a loss for the opposing player) to the win set
-    bool updateW = false;
+    bool updateW = !loseFrontier.empty();
 #pragma omp parallel
     {
-      local_frontier_t localWins;
-      localWins.reserve(loseFrontier.size() / numThreads);
-      local_frontier_t localPreds;
-      localPreds.reserve(loseFrontier.size());
+      auto& localPreds = threadPreds[omp_get_thread_num()];
+      auto& localWins = threadLabels[omp_get_thread_num()];
+#ifdef SUCCESSOR_COUNTERS
+      auto& localPredSuccs = threadPredSuccs[omp_get_thread_num()];
+#endif
       
-      // The technique for parallelizing over an unordered set is inspired by the following answer by 'Richard'
-      // on June 21, 2019
-      // Answer: https://stackoverflow.com/a/56710797
-      // Author: https://stackoverflow.com/users/752843/richard
-#pragma omp for nowait
-      for (::std::size_t i = 0; i < loseFrontier.bucket_count(); ++i)
-      for (auto bState = loseFrontier.begin(i); bState != loseFrontier.end(i); ++bState)
+#pragma omp for schedule(dynamic) nowait
+      for (::std::size_t s = 0; s < frontier_t::NUM_SHARDS; ++s)
+      for (const auto& bState : loseFrontier.shard(s))
       {
 #ifdef TRACK_RETROGRADE_ANALYSIS
         print_win(bState, v);
 #endif
-        localWins.push_back(*bState);
+        localWins[s].push_back(bState);
 
-        if (!updateW)
+        auto preds = generatePredecessors(bState);
+        for (auto& pred : preds)
         {
-#pragma omp critical
+          auto predShard = winFrontier.shardIndex(pred);
+#ifdef SUCCESSOR_COUNTERS
+          // the counters and the store are only written after the barrier below. Successors are 
+          // generated once, when a position is first reached from a new win. Every later win among 
+          // its successors reaches it again through predecessor generation
+          int numSuccs = 0;
+          if (store.isCandidate(pred) && !remainingSuccs.contains(predShard, pred))
           {
-            updateW = true;
+            for (const auto& succ : generateSuccessors(pred))
+              numSuccs += !store.isWin(succ);
           }
+          localPredSuccs[predShard].push_back(numSuccs);
+#endif
+          localPreds[predShard].push_back(::std::move(pred));
         }
-        auto preds = generatePredecessors(*bState);
-        localPreds.insert(::std::end(localPreds), ::std::begin(preds), ::std::end(preds));
       }
-      // critical section - each thread adds to win buffer
-#pragma omp critical
+      // every thread merges whole shards of the buffers of all threads, so no two threads 
+      // write to the same shard of the frontier or of the result store
+#pragma omp barrier
+#pragma omp for schedule(dynamic)
+      for (::std::size_t s = 0; s < frontier_t::NUM_SHARDS; ++s)
       {
-        for (const auto& prev : localPreds)
+        for (::std::size_t t = 0; t < threadPreds.size(); ++t)
         {
-          if (wins.find(prev) == wins.end() && losses.find(prev) == losses.end())
-            winFrontier.insert(prev);
+          auto& preds = threadPreds[t][s];
+          for (::std::size_t i = 0; i < preds.size(); ++i)
+          {
+            const auto& prev = preds[i];
+            if (!store.isCandidate(prev))
+              continue;
+#ifdef SUCCESSOR_COUNTERS
+            if (remainingSuccs.decrement(s, prev, threadPredSuccs[t][s][i]))
+              winFrontier.shard(s).insert(prev);
+#else
+            winFrontier.shard(s).insert(prev);
+#endif
+          }
+          preds.clear();
+#ifdef SUCCESSOR_COUNTERS
+          threadPredSuccs[t][s].clear();
+#endif
         }
-        for (const auto& localWin : localWins)
+        for (auto& wins : threadLabels)
         {
-          wins.insert(localWin);
-          depthToMate[localWin] = v;
+          for (const auto& localWin : wins[s])
+          {
+            store.markWin(localWin, v);
+#ifdef SUCCESSOR_COUNTERS
+            remainingSuccs.erase(s, localWin);
+#endif
+          }
+          if (checkpoint)
+            newWins[s].insert(newWins[s].end(), wins[s].begin(), wins[s].end());
+          wins[s].clear();
         }
       }
     }
@@ -184,66 +343,105 @@ auto retrogradeAnalysisBaseImpl(::std::unordered_set<BoardState<FlattenedSz, Non
     loseFrontier.clear(); 
 
     if(updateW == false){
-      return ::std::make_tuple(wins, losses, depthToMate);
+      break;
     }
     bool updateL = false;
     // 3. Lose iteration - add immediate losses (all successors are win for opponent) to the lose set
 #pragma omp parallel
     {
-      local_frontier_t localLosses;
-      localLosses.reserve(winFrontier.size() / numThreads);
-      local_frontier_t localPreds;
-      localPreds.reserve(winFrontier.size());
+      auto& localPreds = threadPreds[omp_get_thread_num()];
+      auto& localLosses = threadLabels[omp_get_thread_num()];
             
-#pragma omp for nowait
-      for (::std::size_t i = 0; i < winFrontier.bucket_count(); ++i)
-      for (auto bState = winFrontier.begin(i); bState != winFrontier.end(i); ++bState)
+#pragma omp for schedule(dynamic) nowait
+      for (::std::size_t s = 0; s < frontier_t::NUM_SHARDS; ++s)
+      for (const auto& bState : winFrontier.shard(s))
       {
         // omp start parallel section
-        auto succs = generateSuccessors(*bState);
         bool allWins = true;
+#ifndef SUCCESSOR_COUNTERS
+        auto succs = generateSuccessors(bState);
         for (const auto& succ : succs)
         {
-          if (wins.find(succ) == wins.end())
+          if (!store.isWin(succ))
           {
             allWins = false;
             break;
           }
         }
+#endif
         if (allWins)
         {
 #ifdef TRACK_RETROGRADE_ANALYSIS
           print_loss(bState, v);
 #endif
-          localLosses.push_back(*bState);
-          auto preds = generatePredecessors(*bState);
-          localPreds.insert(::std::end(localPreds), ::std::begin(preds), ::std::end(preds));
+          localLosses[s].push_back(bState);
+          auto preds = generatePredecessors(bState);
+          for (auto& pred : preds)
+            localPreds[loseFrontier.shardIndex(pred)].push_back(::std::move(pred));
         }
       }
-#pragma omp critical
+#pragma omp barrier
+#pragma omp for schedule(dynamic) reduction(||:updateL)
+      for (::std::size_t s = 0; s < frontier_t::NUM_SHARDS; ++s)
       {
-        for (const auto& prev : localPreds)
+        for (auto& preds : threadPreds)
         {
-          if (wins.find(prev) == wins.end() && losses.find(prev) == losses.end())
-            loseFrontier.insert(prev);
+          for (const auto& prev : preds[s])
+          {
+            if (store.isCandidate(prev))
+              loseFrontier.shard(s).insert(prev);
+          }
+          preds[s].clear();
         }
-        for (const auto& localLoss : localLosses)
+        for (auto& losses : threadLabels)
         {
-          if (!updateL)
+          for (const auto& localLoss : losses[s])
+          {
             updateL = true;
-          losses.insert(localLoss);
-          depthToMate[localLoss] = v;
+            store.markLoss(localLoss, v);
+#ifdef SUCCESSOR_COUNTERS
+            remainingSuccs.erase(s, localLoss);
+#endif
+          }
+          if (checkpoint)
+            newLosses[s].insert(newLosses[s].end(), losses[s].begin(), losses[s].end());
+          losses[s].clear();
         }
       }
     }
     // clear the whole win frontier
     winFrontier.clear();
     std::cout << "done with v=" << v << " " << loseFrontier.size() << std::endl;
+    if (checkpoint)
+      checkpoint->append(store, v, ::std::move(newWins), ::std::move(newLosses));
     if(updateL == false) {
-      return ::std::make_tuple(wins, losses, depthToMate);
+      break;
     }
   }
-  return ::std::make_tuple(wins, losses, depthToMate);
+  if (checkpoint)
+    checkpoint->wait();
+}
+
+// Runs retrograde analysis against a hash result store and returns its wins, losses and depth-to-mate
+template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t N, 
+  ::std::size_t rowSz, ::std::size_t colSz,
+  typename MoveGenerator, typename ReverseMoveGenerator, typename HorizontalSymFn=false_fn, 
+  typename VerticalSymFn=false_fn, typename IsValidBoardFn=null_type, 
+  typename ::std::enable_if<::std::is_base_of<GenerateForwardMoves<FlattenedSz, NonPlacementDataType>, 
+    MoveGenerator>::value>::type* = nullptr,
+  typename ::std::enable_if<::std::is_base_of<GenerateReverseMoves<FlattenedSz, NonPlacementDataType>, 
+    ReverseMoveGenerator>::value>::type* = nullptr>
+auto retrogradeAnalysisBaseImpl(::std::unordered_set<BoardState<FlattenedSz, NonPlacementDataType>, BoardStateHasher<FlattenedSz, NonPlacementDataType>> checkmates,
+    MoveGenerator generateSuccessors,
+    ReverseMoveGenerator generatePredecessors,
+    HorizontalSymFn hzSymFn={}, VerticalSymFn vSymFn={}, 
+    IsValidBoardFn isValidBoardFn={})
+{
+  HashResultStore<FlattenedSz, NonPlacementDataType> store;
+  retrogradeAnalysisBaseImpl<FlattenedSz, NonPlacementDataType, N, rowSz, colSz, MoveGenerator, ReverseMoveGenerator, 
+    HorizontalSymFn, VerticalSymFn, IsValidBoardFn>(store, ::std::move(checkmates), generateSuccessors, 
+      generatePredecessors, hzSymFn, vSymFn, isValidBoardFn);
+  return ::std::make_tuple(::std::move(store.wins), ::std::move(store.losses), ::std::move(store.depthToMate));
 }
 
 #endif
@@ -22,15 +22,403 @@
 #define STATE_HPP_
 
 #include <array>
+#include <bit>
 #include <bitset>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
 #include <tuple>
 #include <cassert>
+#include <concepts>
 #include <functional>
 #include <string>
 
 #include "piece_label.hpp"
+#include "board_hash.hpp"
+
+// compile time copies of the ruleset's labels, used to size the bitboards and zobrist tables
+constexpr piece_label_t RULESET_NON_ROYAL_LABELS[] = NO_ROYALTY_PIECESET;
+constexpr piece_label_t RULESET_ROYAL_LABELS[] = ROYALTY_PIECESET;
+
+// Each uncolored piece kind of the ruleset gets an index (and its own bitboard). Royal kinds come
+// last so that the royal pieces can be found with a single mask.
+struct PieceKinds
+{
+  static constexpr ::std::uint8_t NO_KIND = 0xFF;
+
+  ::std::array<piece_label_t, 16> whiteLabels{};
+  ::std::array<piece_label_t, 16> blackLabels{};
+  ::std::array<::std::uint8_t, 256> kindOf{};
+  ::std::size_t count = 0;
+  ::std::size_t firstRoyal = 0;
+};
+
+constexpr PieceKinds makePieceKinds()
+{
+  PieceKinds kinds;
+  kinds.kindOf.fill(PieceKinds::NO_KIND);
+
+  auto addKind = [&](piece_label_t p) {
+    piece_label_t black = (p >= 'A' && p <= 'Z') ? p - 'A' + 'a' : p;
+    piece_label_t white = (p >= 'a' && p <= 'z') ? p - 'a' + 'A' : p;
+    if (kinds.kindOf[black] != PieceKinds::NO_KIND)
+      return;
+    kinds.blackLabels[kinds.count] = black;
+    kinds.whiteLabels[kinds.count] = white;
+    kinds.kindOf[black] = kinds.kindOf[white] = kinds.count;
+    ++kinds.count;
+  };
+
+  for (auto p : RULESET_NON_ROYAL_LABELS)
+    addKind(p);
+  kinds.firstRoyal = kinds.count;
+  for (auto p : RULESET_ROYAL_LABELS)
+    addKind(p);
+  return kinds;
+}
+
+inline constexpr PieceKinds PIECE_KINDS = makePieceKinds();
+
+#ifdef BITBOARD_STATE
+// index of the lowest set bit of a nonzero bitboard
+template <typename WordType>
+inline ::std::size_t lowestSquare(WordType w)
+{
+  if constexpr (sizeof(WordType) <= sizeof(::std::uint64_t))
+    return ::std::countr_zero(w);
+  else
+  {
+    auto lo = static_cast<::std::uint64_t>(w);
+    return lo ? ::std::countr_zero(lo) : 64 + ::std::countr_zero(static_cast<::std::uint64_t>(w >> 64));
+  }
+}
+
+// Piece placement stored as one bitboard per piece kind plus one per color. A 64 bit word is used
+// for boards of up to 64 squares (chess) and a 128 bit word otherwise (capablanca, xiangqi).
+// Squares are read and written through the same interface as the std::array placement.
+template <::std::size_t FlattenedSz>
+class BitboardPlacement
+{
+public:
+  static_assert(FlattenedSz <= 128, "bitboard placement supports at most 128 squares");
+  using word_t = ::std::conditional_t<(FlattenedSz <= 64), ::std::uint64_t, unsigned __int128>;
+
+  // writable view of a single square so that m_board[sq] = label keeps working
+  class reference
+  {
+    BitboardPlacement* m_placement;
+    ::std::size_t m_sq;
+
+  public:
+    reference(BitboardPlacement* placement, ::std::size_t sq)
+      : m_placement(placement), m_sq(sq)
+    {}
+
+    operator piece_label_t() const { return m_placement->get(m_sq); }
+
+    reference& operator=(piece_label_t p)
+    {
+      m_placement->set(m_sq, p);
+      return *this;
+    }
+
+    reference& operator=(const reference& other) { return *this = static_cast<piece_label_t>(other); }
+  };
+
+  class const_iterator
+  {
+    const BitboardPlacement* m_placement;
+    ::std::size_t m_sq;
+
+  public:
+    using iterator_category = ::std::input_iterator_tag;
+    using value_type = piece_label_t;
+    using difference_type = ::std::ptrdiff_t;
+    using pointer = const piece_label_t*;
+    using reference = piece_label_t;
+
+    const_iterator(const BitboardPlacement* placement, ::std::size_t sq)
+      : m_placement(placement), m_sq(sq)
+    {}
+
+    piece_label_t operator*() const { return m_placement->get(m_sq); }
+    const_iterator& operator++() { ++m_sq; return *this; }
+    const_iterator operator++(int) { auto prev = *this; ++m_sq; return prev; }
+    bool operator==(const const_iterator& other) const { return m_sq == other.m_sq; }
+    bool operator!=(const const_iterator& other) const { return m_sq != other.m_sq; }
+  };
+
+private:
+  ::std::array<word_t, PIECE_KINDS.count> m_kindBB{};
+  word_t m_whiteBB = 0;
+  word_t m_blackBB = 0;
+
+  static constexpr word_t bit(::std::size_t sq) { return static_cast<word_t>(1) << sq; }
+
+public:
+  BitboardPlacement() = default;
+
+  BitboardPlacement(const ::std::array<piece_label_t, FlattenedSz>& mailbox)
+  {
+    for (::std::size_t sq = 0; sq < FlattenedSz; ++sq)
+      set(sq, mailbox[sq]);
+  }
+
+  BitboardPlacement(::std::initializer_list<piece_label_t> labels)
+  {
+    assert(labels.size() <= FlattenedSz);
+    ::std::size_t sq = 0;
+    for (auto p : labels)
+      set(sq++, p);
+  }
+
+  static constexpr ::std::size_t size() { return FlattenedSz; }
+
+  piece_label_t get(::std::size_t sq) const
+  {
+    auto mask = bit(sq);
+    if (!((m_whiteBB | m_blackBB) & mask))
+      return '\0';
+
+    for (::std::size_t k = 0; k < PIECE_KINDS.count; ++k)
+      if (m_kindBB[k] & mask)
+        return (m_whiteBB & mask) ? PIECE_KINDS.whiteLabels[k] : PIECE_KINDS.blackLabels[k];
+    return '\0';
+  }
+
+  void set(::std::size_t sq, piece_label_t p)
+  {
+    auto mask = bit(sq);
+    if ((m_whiteBB | m_blackBB) & mask)
+    {
+      for (auto& bb : m_kindBB)
+        bb &= ~mask;
+      m_whiteBB &= ~mask;
+      m_blackBB &= ~mask;
+    }
+    if (isEmpty(p))
+      return;
+
+    auto k = PIECE_KINDS.kindOf[p];
+    assert(k != PieceKinds::NO_KIND);
+    if (k == PieceKinds::NO_KIND)
+      return;
+    m_kindBB[k] |= mask;
+    (isWhite(p) ? m_whiteBB : m_blackBB) |= mask;
+  }
+
+  piece_label_t operator[](::std::size_t sq) const { return get(sq); }
+  reference operator[](::std::size_t sq) { return reference(this, sq); }
+
+  piece_label_t at(::std::size_t sq) const
+  {
+    assert(sq < FlattenedSz);
+    return get(sq);
+  }
+
+  reference at(::std::size_t sq)
+  {
+    assert(sq < FlattenedSz);
+    return reference(this, sq);
+  }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, FlattenedSz); }
+
+  word_t occupancy() const { return m_whiteBB | m_blackBB; }
+  word_t colorOccupancy(bool white) const { return white ? m_whiteBB : m_blackBB; }
+  const auto& kindBoards() const { return m_kindBB; }
+
+  word_t royalOccupancy() const
+  {
+    word_t royals = 0;
+    for (::std::size_t k = PIECE_KINDS.firstRoyal; k < PIECE_KINDS.count; ++k)
+      royals |= m_kindBB[k];
+    return royals;
+  }
+
+  bool isRoyalAt(::std::size_t sq) const { return royalOccupancy() & bit(sq); }
+
+  // first square holding the label or FlattenedSz if it is not on the board
+  ::std::size_t find(piece_label_t p) const
+  {
+    auto k = PIECE_KINDS.kindOf[p];
+    if (isEmpty(p) || k == PieceKinds::NO_KIND)
+      return FlattenedSz;
+    auto bb = m_kindBB[k] & colorOccupancy(isWhite(p));
+    return bb ? lowestSquare(bb) : FlattenedSz;
+  }
+
+  bool operator==(const BitboardPlacement&) const = default;
+};
+
+template<::std::size_t FlattenedSz>
+using square_storage_t = BitboardPlacement<FlattenedSz>;
+#else
+template<::std::size_t FlattenedSz>
+using square_storage_t = ::std::array<piece_label_t, FlattenedSz>;
+#endif
+
+// The same pseudo random keys are generated on every build and every MPI rank
+template <::std::size_t Rows, ::std::size_t Cols>
+constexpr auto makeZobristKeys(::std::uint64_t seed)
+{
+  ::std::array<::std::array<::std::uint64_t, Cols>, Rows> keys{};
+  for (auto& row : keys)
+    for (auto& key : row)
+    {
+      // splitmix64
+      seed += 0x9e3779b97f4a7c15ull;
+      auto z = seed;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      key = z ^ (z >> 31);
+    }
+  return keys;
+}
+
+// one key per square for every colored piece kind: [square][kind + (white ? kinds : 0)]
+template <::std::size_t FlattenedSz>
+inline constexpr auto ZOBRIST_PLACEMENT_KEYS = makeZobristKeys<FlattenedSz, 2 * PIECE_KINDS.count>(0x5c7a99ull);
+
+inline constexpr ::std::uint64_t ZOBRIST_PLAYER_KEY = makeZobristKeys<1, 1>(0x9a7e4ull)[0][0];
+
+// one key per value of every byte of the non placement data
+template <typename NonPlacementDataType>
+inline constexpr auto ZOBRIST_NPD_KEYS = makeZobristKeys<sizeof(NonPlacementDataType), 256>(0xda7aull);
+
+template <::std::size_t FlattenedSz>
+inline ::std::uint64_t zobristKey(::std::size_t sq, piece_label_t p)
+{
+  if (isEmpty(p))
+    return 0;
+  auto k = PIECE_KINDS.kindOf[p];
+  assert(k != PieceKinds::NO_KIND);
+  if (k == PieceKinds::NO_KIND)
+    return 0;
+  return ZOBRIST_PLACEMENT_KEYS<FlattenedSz>[sq][k + (isWhite(p) ? PIECE_KINDS.count : 0)];
+}
+
+// Keys the bytes of the non placement data. Types with padding bytes cannot be keyed this
+// way and do not contribute to the hash.
+template <typename NonPlacementDataType>
+inline ::std::uint64_t zobristKey(const NonPlacementDataType& npd)
+{
+  if constexpr (!hasByteRepresentation<NonPlacementDataType>())
+    return 0;
+  else
+  {
+    const auto& keys = ZOBRIST_NPD_KEYS<NonPlacementDataType>;
+    auto bytes = reinterpret_cast<const unsigned char*>(&npd);
+    ::std::uint64_t key = 0;
+    for (::std::size_t i = 0; i < sizeof(NonPlacementDataType); ++i)
+      key ^= keys[i][bytes[i]];
+    return key;
+  }
+}
+
+#ifdef ZOBRIST_HASHING
+// Wraps the square storage and keeps the zobrist key of the placement up to date on every
+// write, so boards produced by the PMOs (two square writes per move) are rehashed in O(1).
+template <::std::size_t FlattenedSz, typename SquareStorage>
+class ZobristPlacement
+{
+  SquareStorage m_squares{};
+  ::std::uint64_t m_key = 0;
+
+public:
+  // writable view of a single square so that m_board[sq] = label keeps working
+  class reference
+  {
+    ZobristPlacement* m_placement;
+    ::std::size_t m_sq;
+
+  public:
+    reference(ZobristPlacement* placement, ::std::size_t sq)
+      : m_placement(placement), m_sq(sq)
+    {}
+
+    operator piece_label_t() const { return m_placement->m_squares[m_sq]; }
+
+    reference& operator=(piece_label_t p)
+    {
+      m_placement->set(m_sq, p);
+      return *this;
+    }
+
+    reference& operator=(const reference& other) { return *this = static_cast<piece_label_t>(other); }
+  };
+
+  ZobristPlacement() = default;
+
+  ZobristPlacement(const ::std::array<piece_label_t, FlattenedSz>& mailbox)
+  {
+    for (::std::size_t sq = 0; sq < FlattenedSz; ++sq)
+      set(sq, mailbox[sq]);
+  }
+
+  ZobristPlacement(::std::initializer_list<piece_label_t> labels)
+  {
+    assert(labels.size() <= FlattenedSz);
+    ::std::size_t sq = 0;
+    for (auto p : labels)
+      set(sq++, p);
+  }
+
+  static constexpr ::std::size_t size() { return FlattenedSz; }
+
+  void set(::std::size_t sq, piece_label_t p)
+  {
+    piece_label_t prev = m_squares[sq];
+    m_key ^= zobristKey<FlattenedSz>(sq, prev) ^ zobristKey<FlattenedSz>(sq, p);
+    m_squares[sq] = p;
+  }
+
+  piece_label_t operator[](::std::size_t sq) const { return m_squares[sq]; }
+  reference operator[](::std::size_t sq) { return reference(this, sq); }
+
+  piece_label_t at(::std::size_t sq) const
+  {
+    assert(sq < FlattenedSz);
+    return m_squares[sq];
+  }
+
+  reference at(::std::size_t sq)
+  {
+    assert(sq < FlattenedSz);
+    return reference(this, sq);
+  }
+
+  auto begin() const { return m_squares.begin(); }
+  auto end() const { return m_squares.end(); }
+
+  ::std::uint64_t key() const { return m_key; }
+  const SquareStorage& squares() const { return m_squares; }
+
+  bool operator==(const ZobristPlacement& other) const { return m_squares == other.m_squares; }
+};
+
+template <::std::size_t FlattenedSz, typename SquareStorage>
+const SquareStorage& squaresOf(const ZobristPlacement<FlattenedSz, SquareStorage>& placement)
+{
+  return placement.squares();
+}
+
+template<::std::size_t FlattenedSz>
+using board_placement_t = ZobristPlacement<FlattenedSz, square_storage_t<FlattenedSz>>;
+#else
+template<::std::size_t FlattenedSz>
+using board_placement_t = square_storage_t<FlattenedSz>;
+#endif
+
+// the square storage underneath the placement
+template <typename SquareStorage>
+const SquareStorage& squaresOf(const SquareStorage& squares)
+{
+  return squares;
+}
 
-#if 1
 // The flattened size is the 1d size of the board. Ex: 8x8 chess has flattened size of 64
 // The NonPlacementDataType is any domain-specific type inserted by the user
 template<::std::size_t FlattenedSz, typename NonPlacementDataType>
@@ -39,7 +427,7 @@ struct BoardState
   // 1 for white move. 0 for black move
   //::std::bitset<1> m_player;
   bool m_player;
-  ::std::array<piece_label_t, FlattenedSz> m_board{};
+  board_placement_t<FlattenedSz> m_board{};
   NonPlacementDataType nonPlacementData;
 };
 
@@ -47,49 +435,130 @@ struct BoardState
 template<typename NonPlacementDataType>
 std::string NPDToString(const NonPlacementDataType& npd);
 
-// TODO: hash the NonPlacementType? 
 template<::std::size_t FlattenedSz, typename NonPlacementDataType>
 struct BoardStateHasher
 {
   auto operator()(const BoardState<FlattenedSz, NonPlacementDataType>& b) const
   {
-    ::std::string stringifiedBoard(b.m_board.begin(), b.m_board.end());
-    stringifiedBoard += static_cast<char>(b.m_player);
-    
-    return ::std::hash<::std::string>{}(stringifiedBoard); 
+#if defined(ZOBRIST_HASHING)
+    return static_cast<::std::size_t>(b.m_board.key() ^ (b.m_player ? ZOBRIST_PLAYER_KEY : 0) ^
+        zobristKey(b.nonPlacementData));
+#elif defined(BITBOARD_STATE)
+    // the boards are mostly empty, so every word is multiplied through before it is folded in
+    ::std::uint64_t h = b.m_player;
+    auto combine = [&h](auto w) {
+      for (::std::size_t i = 0; i < sizeof(w); i += sizeof(::std::uint64_t))
+      {
+        h = (h ^ static_cast<::std::uint64_t>(w >> (8 * i))) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+      }
+    };
+    for (const auto& bb : b.m_board.kindBoards())
+      combine(bb);
+    combine(b.m_board.colorOccupancy(true));
+    if constexpr (hasByteRepresentation<NonPlacementDataType>())
+      h = hashBytes<sizeof(NonPlacementDataType)>(
+          reinterpret_cast<const unsigned char*>(&b.nonPlacementData), h);
+    return static_cast<::std::size_t>(h);
+#else
+    auto h = hashBytes<FlattenedSz>(b.m_board.data(), b.m_player);
+    if constexpr (hasByteRepresentation<NonPlacementDataType>())
+      h = hashBytes<sizeof(NonPlacementDataType)>(
+          reinterpret_cast<const unsigned char*>(&b.nonPlacementData), h);
+    return static_cast<::std::size_t>(h);
+#endif
   }
 };
 
+// Boards are equal if the side to move, the placement and the non placement data all match.
+// Non placement data without a byte representation is compared with its own operator== if it has one.
 template<::std::size_t FlattenedSz, typename NonPlacementDataType>
 bool operator==(const BoardState<FlattenedSz, NonPlacementDataType>& x, const BoardState<FlattenedSz, NonPlacementDataType>& y){
-	return x.m_board == y.m_board;
+  if (x.m_player != y.m_player)
+    return false;
+
+  if constexpr (::std::is_same_v<board_placement_t<FlattenedSz>, ::std::array<piece_label_t, FlattenedSz>>)
+  {
+    if (!bytesEqual<FlattenedSz>(x.m_board.data(), y.m_board.data()))
+      return false;
+  }
+  else if (!(x.m_board == y.m_board))
+    return false;
+
+  if constexpr (hasByteRepresentation<NonPlacementDataType>())
+    return bytesEqual<sizeof(NonPlacementDataType)>(
+        reinterpret_cast<const unsigned char*>(&x.nonPlacementData),
+        reinterpret_cast<const unsigned char*>(&y.nonPlacementData));
+  else if constexpr (::std::equality_comparable<NonPlacementDataType>)
+    return x.nonPlacementData == y.nonPlacementData;
+  else
+    return true;
 }
-#else // TODO: Potential future bitboard optimization 
-template<::std::size_t FlattenedSz, typename NonPlacementDataType, ::std::size_t NumUniquePieces>
-struct bb_state
+
+// Calls fn(square) for every square holding a piece of the given color until fn returns false.
+// Returns false if the loop was stopped early.
+template<::std::size_t FlattenedSz, typename NonPlacementDataType, typename ForEachSquareFunc>
+bool forEachPieceOfColor(const BoardState<FlattenedSz, NonPlacementDataType>& b, bool white, ForEachSquareFunc fn)
 {
-  using bitboard_t = ::std::bitset<FlattenedSz>;
+#ifdef BITBOARD_STATE
+  for (auto bb = squaresOf(b.m_board).colorOccupancy(white); bb; bb &= bb - 1)
+    if (!fn(lowestSquare(bb)))
+      return false;
+#else
+  for (::std::size_t sq = 0; sq < FlattenedSz; ++sq)
+  {
+    piece_label_t p = b.m_board[sq];
+    if (isEmpty(p) || isWhite(p) != white)
+      continue;
+    if (!fn(sq))
+      return false;
+  }
+#endif
+  return true;
+}
 
-  ::std::array<bitboard_t, NumUniquePieces> m_piece_bb;
+template<::std::size_t FlattenedSz, typename NonPlacementDataType>
+bool isRoyalAt(const BoardState<FlattenedSz, NonPlacementDataType>& b, ::std::size_t sq)
+{
+#ifdef BITBOARD_STATE
+  return squaresOf(b.m_board).isRoyalAt(sq);
+#else
+  return isRoyal(b.m_board[sq]);
+#endif
+}
 
-  bitboard_t m_white_bit_board;
-  bitboard_t m_black_bit_board;
-  NonPlacementDataType nonPlacementData;
+/*
+ * Assigns every board to one of numParts() parts, such as the ranks of a cluster. Partitioners are
+ * passed to the solvers by their concrete type, so the virtual calls are resolved at compile time.
+ * See state_space_partition.hpp for partitions that balance any number of parts.
+ */
+template <typename BoardType>
+class StateSpacePartition
+{
+public:
+  virtual ~StateSpacePartition(void) = default;
+
+  virtual int operator()(const BoardType& b) const = 0;
+
+  virtual int numParts(void) const = 0;
 };
-#endif
 
-// TODO: better scheme as future work.
 // contingent on the location of a single piece on the board. each 
-// process is assigned all positions dependent on position of one piece
+// process is assigned all positions dependent on position of one piece.
+// The last process also takes the squares left over when K does not divide the board
 template <::std::size_t FlattenedSz, typename BoardType>
-class KStateSpacePartition
+class KStateSpacePartition final : public StateSpacePartition<BoardType>
 {
   piece_label_t m_toTrack;
+  int m_K;
   int m_segLength;
 
+  int segmentOf(int idx) const { return ::std::min(idx / m_segLength, m_K - 1); }
+
 public:
   KStateSpacePartition(const piece_label_t& toTrack, int K)
     : m_toTrack(toTrack),
+      m_K(K),
       m_segLength(FlattenedSz / K)
   {
     // with this partitioning scheme, cannot have more nodes than max board size.
@@ -97,8 +566,11 @@ public:
   }
   
   // Contingent on tracked piece location 
-  int operator()(const BoardType& b) const
+  int operator()(const BoardType& b) const override
   {
+#ifdef BITBOARD_STATE
+    int idx = squaresOf(b.m_board).find(m_toTrack);
+#else
     int idx = 0;
     
     for (const auto& c : b.m_board)
@@ -108,19 +580,22 @@ public:
 
       ++idx;
     }
-    return idx / m_segLength;
+#endif
+    return segmentOf(idx);
   }
 
+  int numParts(void) const override { return m_K; }
+
   auto getRange(int k) const
   {
     return ::std::make_tuple(k * m_segLength, 
-        ::std::min((k+1) * m_segLength, static_cast<int>(FlattenedSz)));
+        k == m_K - 1 ? static_cast<int>(FlattenedSz) : (k+1) * m_segLength);
   }
   
   inline bool checkInRange(const auto& startBoard, 
     const auto& currentBoard) const
   {
-    return (currentBoard[0] - startBoard[0]) < m_segLength; 
+    return segmentOf(currentBoard[0]) == segmentOf(startBoard[0]); 
   }
 };
 
@@ -0,0 +1,108 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Partitions of the state space that spread positions evenly over any number of parts, unlike
+ * KStateSpacePartition, which splits the squares of one piece and so is capped at one part per square
+ * and follows how unevenly positions are spread over that piece's squares.
+ */
+
+#ifndef STATE_SPACE_PARTITION_HPP_
+#define STATE_SPACE_PARTITION_HPP_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+#include "state.hpp"
+#include "position_index.hpp"
+
+// Assigns a board to the part selected by its hash. Needs no knowledge of the material on the board
+template <::std::size_t FlattenedSz, typename NonPlacementDataType>
+class HashStateSpacePartition final : public StateSpacePartition<BoardState<FlattenedSz, NonPlacementDataType>>
+{
+  BoardStateHasher<FlattenedSz, NonPlacementDataType> m_hasher;
+  int m_numParts;
+
+public:
+  HashStateSpacePartition(int numParts)
+    : m_numParts(numParts)
+  {
+    assert(numParts > 0);
+  }
+
+  int operator()(const BoardState<FlattenedSz, NonPlacementDataType>& b) const override
+  {
+    // the hash tables of every part also index by this hash, so it is remixed to keep the boards of
+    // one part from sharing their low bits
+    ::std::uint64_t h = m_hasher(b);
+    h = (h ^ (h >> 31)) * 0x7fb5d329728ea185ull;
+    h ^= h >> 27;
+    return static_cast<int>(h % static_cast<::std::uint64_t>(m_numParts));
+  }
+
+  int numParts(void) const override { return m_numParts; }
+};
+
+/*
+ * Assigns every part one contiguous range of the indices of a MaterialIndexer, all of the same size
+ * but the last. A position's part and its offset in that part follow from its index alone, so per-part
+ * data may be kept in flat arrays. Boards with material outside of the indexer fall back to their hash.
+ */
+template <::std::size_t FlattenedSz, typename NonPlacementDataType>
+class IndexRangeStateSpacePartition final : public StateSpacePartition<BoardState<FlattenedSz, NonPlacementDataType>>
+{
+  MaterialIndexer<FlattenedSz> m_indexer;
+  HashStateSpacePartition<FlattenedSz, NonPlacementDataType> m_untracked;
+  int m_numParts;
+  position_index_t m_partSz;
+
+public:
+  IndexRangeStateSpacePartition(MaterialIndexer<FlattenedSz> indexer, int numParts)
+    : m_indexer(::std::move(indexer)), m_untracked(numParts), m_numParts(numParts),
+      m_partSz(m_indexer.size() / numParts + (m_indexer.size() % numParts != 0))
+  {
+  }
+
+  int operator()(const BoardState<FlattenedSz, NonPlacementDataType>& b) const override
+  {
+    auto idx = m_indexer(b);
+    if (idx == NULL_POSITION_INDEX)
+      return m_untracked(b);
+    return owner(idx);
+  }
+
+  int numParts(void) const override { return m_numParts; }
+
+  const MaterialIndexer<FlattenedSz>& indexer(void) const { return m_indexer; }
+
+  int owner(position_index_t idx) const { return static_cast<int>(idx / m_partSz); }
+
+  // offset of an index within the range of its owner
+  position_index_t offset(position_index_t idx) const { return idx % m_partSz; }
+
+  position_index_t first(int part) const
+  {
+    return ::std::min(m_indexer.size(), static_cast<position_index_t>(part) * m_partSz);
+  }
+
+  position_index_t partSize(int part) const { return first(part + 1) - first(part); }
+
+  // the size of every range but the last, so that offsets are valid in any part
+  position_index_t maxPartSize(void) const { return m_partSz; }
+};
+
+#endif
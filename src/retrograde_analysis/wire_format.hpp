@@ -0,0 +1,176 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compact encoding of the predecessor batches exchanged by cluster ranks. Rather than a full board, each
+ * predecessor is sent as its MaterialIndexer index and a label word, both as variable length integers.
+ * Sorting a batch by index and sending the differences between consecutive indices usually takes the
+ * index down to one or two bytes.
+ */
+
+#ifndef WIRE_FORMAT_HPP_
+#define WIRE_FORMAT_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "state.hpp"
+#include "position_index.hpp"
+
+/*
+ * A packed batch is laid out as
+ *   one flags byte, whose lowest bit is set if the indices are delta encoded
+ *   the number of indexed entries
+ *   for each indexed entry, its index (or the difference to the previous one) and its label word
+ *   the raw bytes of the entries without an index, up to the end of the batch
+ * where every number is a LEB128 variable length integer and the label word is
+ * zigzag(G) << 1 | winLabel. An entry has no index if its material is outside of the indexer or if its
+ * non placement data differs from the default, which unranking would not restore.
+ *
+ * CommData must hold a bool winLabel, a short G and a board b, as NodeCommData does.
+ */
+template <::std::size_t FlattenedSz, typename CommData>
+class PackedWireFormat
+{
+  static_assert(::std::is_trivially_copyable_v<CommData>, "entries without an index are sent as raw bytes");
+
+  using board_t = decltype(CommData::b);
+
+  static constexpr unsigned char DELTA_ENCODED = 1;
+
+  MaterialIndexer<FlattenedSz> m_indexer;
+  bool m_deltaEncode;
+
+  static void putVarint(::std::uint64_t x, ::std::vector<unsigned char>& out)
+  {
+    while (x >= 0x80)
+    {
+      out.push_back(static_cast<unsigned char>(x | 0x80));
+      x >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(x));
+  }
+
+  static ::std::uint64_t getVarint(const unsigned char*& p)
+  {
+    ::std::uint64_t x = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+      auto byte = *p++;
+      x |= static_cast<::std::uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return x;
+    }
+  }
+
+  static ::std::uint64_t labelWord(const CommData& commData)
+  {
+    auto g = static_cast<::std::int32_t>(commData.G);
+    auto zigzag = static_cast<::std::uint32_t>((g << 1) ^ (g >> 31));
+    return (static_cast<::std::uint64_t>(zigzag) << 1) | commData.winLabel;
+  }
+
+  static void setLabel(::std::uint64_t word, CommData& commData)
+  {
+    auto zigzag = static_cast<::std::uint32_t>(word >> 1);
+    commData.winLabel = word & 1;
+    commData.G = static_cast<short>(static_cast<::std::int32_t>(zigzag >> 1) ^ -static_cast<::std::int32_t>(zigzag & 1));
+  }
+
+  // boards with non default non placement data have no index, so they are sent raw
+  position_index_t indexOf(const board_t& b) const
+  {
+    return m_indexer(b);
+  }
+
+public:
+  PackedWireFormat(MaterialIndexer<FlattenedSz> indexer, bool deltaEncode=true)
+    : m_indexer(::std::move(indexer)), m_deltaEncode(deltaEncode)
+  {
+  }
+
+  // appends the packed batch to out. An empty batch packs to nothing
+  void pack(const CommData* batch, ::std::size_t n, ::std::vector<unsigned char>& out) const
+  {
+    if (n == 0)
+      return;
+
+    ::std::vector<::std::pair<position_index_t, ::std::uint64_t>> indexed;
+    ::std::vector<const CommData*> raw;
+    indexed.reserve(n);
+    for (::std::size_t i = 0; i < n; ++i)
+    {
+      auto idx = indexOf(batch[i].b);
+      if (idx == NULL_POSITION_INDEX)
+        raw.push_back(&batch[i]);
+      else
+        indexed.emplace_back(idx, labelWord(batch[i]));
+    }
+    if (m_deltaEncode)
+      ::std::sort(indexed.begin(), indexed.end());
+
+    out.push_back(m_deltaEncode ? DELTA_ENCODED : 0);
+    putVarint(indexed.size(), out);
+    position_index_t prev = 0;
+    for (const auto& [idx, label] : indexed)
+    {
+      putVarint(m_deltaEncode ? idx - prev : idx, out);
+      putVarint(label, out);
+      prev = idx;
+    }
+    for (const auto* commData : raw)
+    {
+      auto bytes = reinterpret_cast<const unsigned char*>(commData);
+      out.insert(out.end(), bytes, bytes + sizeof(CommData));
+    }
+  }
+
+  // appends the entries of the packed batch of n bytes to batch
+  void unpack(const unsigned char* data, ::std::size_t n, ::std::vector<CommData>& batch) const
+  {
+    if (n == 0)
+      return;
+
+    const unsigned char* p = data;
+    const unsigned char* end = data + n;
+    bool b_delta = *p++ & DELTA_ENCODED;
+    auto numIndexed = getVarint(p);
+    position_index_t prev = 0;
+    for (::std::uint64_t i = 0; i < numIndexed; ++i)
+    {
+      auto idx = getVarint(p);
+      if (b_delta)
+        idx += prev;
+      prev = idx;
+
+      CommData commData{};
+      setLabel(getVarint(p), commData);
+      m_indexer.unrank(idx, commData.b);
+      batch.push_back(commData);
+    }
+    for (; p + sizeof(CommData) <= end; p += sizeof(CommData))
+    {
+      CommData commData;
+      ::std::memcpy(&commData, p, sizeof(CommData));
+      batch.push_back(commData);
+    }
+  }
+};
+
+#endif
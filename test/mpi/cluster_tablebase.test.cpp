@@ -0,0 +1,117 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Has every rank write an uneven slice of positions to one tablebase over several collective rounds, then
+// checks that the headers lay the slices out back to back and that each slice reads back as written.
+// Run with mpirun and any number of processes.
+
+// small writes, so that ranks with short slices still join the rounds of the others
+#define CLUSTER_TABLEBASE_WRITE_SZ 1024
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <cassert>
+
+#include "../../src/retrograde_analysis/state.hpp"
+#include "../../src/retrograde_analysis/cluster_tablebase.hpp"
+#include "../../src/retrograde_analysis/position_index.hpp"
+
+struct npd_t
+{
+  int enpassantRights = -1;
+};
+
+constexpr std::size_t BoardSz = 64;
+using board_t = BoardState<BoardSz, npd_t>;
+using record_t = std::pair<board_t, short>;
+
+struct estimate_t
+{
+  short T;
+};
+
+bool sameRecords(const std::vector<record_t>& x, const std::vector<record_t>& y)
+{
+  return x.size() == y.size() && std::is_permutation(x.begin(), x.end(), y.begin());
+}
+
+int main()
+{
+  MPI_Init(NULL, NULL);
+  int id = 0;
+  int numProcs = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &numProcs);
+
+  std::vector<piece_label_t> pieceSet = { 'k', 'K', 'q' };
+  MaterialIndexer<BoardSz> indexer(pieceSet);
+
+  // rank r holds 100 * (r + 1) positions, the even ones won and the odd ones lost. Checkmates, every
+  // tenth loss, have no estimate data
+  std::vector<board_t> wins;
+  std::vector<board_t> losses;
+  std::unordered_map<board_t, estimate_t, BoardStateHasher<BoardSz, npd_t>> estimateData;
+  std::vector<record_t> expectedWins;
+  std::vector<record_t> expectedLosses;
+  for (position_index_t i = 0; i < 100 * static_cast<position_index_t>(id + 1); ++i)
+  {
+    board_t b;
+    indexer.unrank(i * numProcs + id, b);
+    short depth = static_cast<short>(i % 7);
+    bool b_checkmate = i % 20 == 1;
+    if (!b_checkmate)
+      estimateData[b] = { depth };
+    (i % 2 == 0 ? wins : losses).push_back(b);
+    (i % 2 == 0 ? expectedWins : expectedLosses).emplace_back(b, b_checkmate ? 0 : depth);
+  }
+
+  std::string path = "cluster_tablebase_test.tb";
+  ClusterTablebase::write(path, id, numProcs, "modulo", pieceSet, wins, losses, estimateData);
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  ClusterTablebase::FileHeader header;
+  std::vector<ClusterTablebase::PartHeader> parts;
+  bool b_read = ClusterTablebase::readHeaders(path, header, parts);
+  assert(b_read);
+  assert(header.numParts == numProcs && header.boardSz == sizeof(board_t));
+  assert(std::string(header.partitioner) == "modulo");
+  assert(std::vector<piece_label_t>(header.pieceset, header.pieceset + header.piecesetSz) == pieceSet);
+  std::uint64_t offset = sizeof(header) + numProcs * sizeof(ClusterTablebase::PartHeader);
+  for (const auto& part : parts)
+  {
+    assert(part.offset == offset);
+    offset += (part.numWins + part.numLosses) * header.recordSz;
+  }
+  assert(parts[id].numWins == wins.size() && parts[id].numLosses == losses.size());
+
+  std::vector<record_t> readWins;
+  std::vector<record_t> readLosses;
+  b_read = ClusterTablebase::readSlice(path, id, readWins, readLosses);
+  assert(b_read);
+  assert(sameRecords(readWins, expectedWins));
+  assert(sameRecords(readLosses, expectedLosses));
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (id == 0)
+  {
+    std::remove(path.c_str());
+    std::cout << "test passed" << std::endl;
+  }
+  MPI_Finalize();
+  return 0;
+}
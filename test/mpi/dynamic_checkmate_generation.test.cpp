@@ -0,0 +1,78 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Checks that ranks sharing the checkmate search through a counter each end up with the same checkmates as
+// the static walk of their part, with both a hash and a first piece partitioner. The ranks are threads of an
+// in-process cluster.
+
+#include <iostream>
+
+#ifdef MULTI_NODE
+// small chunks, so that every rank takes many of them
+#define CLUSTER_CHECKMATE_CHUNK_SZ 1000
+
+#include <cassert>
+
+#include "../../src/retrograde_analysis/retrograde_analysis.hpp"
+#include "../../src/retrograde_analysis/state_transition.hpp"
+
+#include "../../src/rules/chess/interface.h"
+
+template <typename MakePartitioner>
+void checkParts(int numRanks, const std::vector<piece_label_t>& fullPieceset, MakePartitioner makePartitioner)
+{
+  runInProcessCluster(numRanks, [&](InProcessTransport& transport)
+  {
+    auto winCondEvaluator = ChessCheckmateEvaluator();
+    auto partitioner = makePartitioner(numRanks);
+
+    std::unordered_set<BoardState<64, ChessNPD>, BoardStateHasher<64, ChessNPD>> staticCheckmates;
+    staticCheckmates = generatePartitionCheckmates<64>(transport.rank(), partitioner,
+        std::move(staticCheckmates), fullPieceset, winCondEvaluator);
+
+    std::unordered_set<BoardState<64, ChessNPD>, BoardStateHasher<64, ChessNPD>> dynamicCheckmates;
+    dynamicCheckmates = generateDynamicPartitionCheckmates<64, ChessNPD>(transport, partitioner,
+        std::move(dynamicCheckmates), fullPieceset, winCondEvaluator);
+
+    assert(!staticCheckmates.empty());
+    assert(dynamicCheckmates == staticCheckmates);
+  });
+}
+
+int main()
+{
+  std::vector<piece_label_t> fullPieceset = { 'k', 'K', 'q' };
+
+  for (int numRanks : { 1, 3 })
+  {
+    checkParts(numRanks, fullPieceset, [](int numParts) { return HashStateSpacePartition<64, ChessNPD>(numParts); });
+    checkParts(numRanks, fullPieceset, [&](int numParts)
+    {
+      return KStateSpacePartition<64, BoardState<64, ChessNPD>>(fullPieceset[0], numParts);
+    });
+  }
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}
+
+#else
+int main()
+{
+  std::cerr << "ERROR: codebase not built with -DMULTI_NODE option." << std::endl;
+  return 1;
+}
+#endif
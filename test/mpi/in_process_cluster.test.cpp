@@ -0,0 +1,86 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Runs the cluster solver on ranks emulated by threads, without mpirun, and checks that the ranks together
+// find the same wins and losses however many of them there are.
+
+#include <iostream>
+
+#ifdef MULTI_NODE
+// small chunks, so that batches arrive while the ranks still walk their frontiers
+#define CLUSTER_POLL_CHUNK_SZ 64
+
+#include <cassert>
+#include <mutex>
+
+#include "../../src/retrograde_analysis/retrograde_analysis.hpp"
+#include "../../src/retrograde_analysis/state_transition.hpp"
+
+#include "../../src/rules/chess/interface.h"
+
+// total wins and losses over all ranks
+std::pair<std::size_t, std::size_t> solveInProcess(int numRanks, const std::vector<piece_label_t>& fullPieceset)
+{
+  constexpr ::std::size_t N      = 3;
+
+  std::mutex mutex;
+  std::size_t numWins = 0;
+  std::size_t numLosses = 0;
+  runInProcessCluster(numRanks, [&](InProcessTransport& transport)
+  {
+    auto fwdMoveGenerator = ChessGenerateForwardMoves();
+    auto revMoveGenerator = ChessGenerateReverseMoves();
+    auto winCondEvaluator = ChessCheckmateEvaluator();
+
+    HashStateSpacePartition<64, ChessNPD> partitioner(transport.size());
+    std::unordered_set<BoardState<64, ChessNPD>, BoardStateHasher<64, ChessNPD>> localCheckmates;
+    localCheckmates = generatePartitionCheckmates<64>(transport.rank(), partitioner,
+        std::move(localCheckmates), fullPieceset, winCondEvaluator);
+
+    auto [wins, losses, dtm] = retrogradeAnalysisClusterImpl<64, ChessNPD, N, ROW_SZ, COL_SZ,
+      decltype(fwdMoveGenerator), decltype(revMoveGenerator)>(partitioner, transport.rank(), transport.size(),
+      std::move(localCheckmates), fwdMoveGenerator, revMoveGenerator, {}, {}, {}, nullptr, nullptr, transport);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    numWins += wins.size();
+    numLosses += losses.size();
+  });
+  return { numWins, numLosses };
+}
+
+int main()
+{
+  std::vector<piece_label_t> fullPieceset = { 'k', 'K', 'q' };
+
+  auto single = solveInProcess(1, fullPieceset);
+  std::cout << "1 rank: wins: " << single.first << " losses: " << single.second << std::endl;
+  assert(single.first > 0 && single.second > 0);
+
+  auto cluster = solveInProcess(3, fullPieceset);
+  std::cout << "3 ranks: wins: " << cluster.first << " losses: " << cluster.second << std::endl;
+  assert(cluster == single);
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}
+
+#else
+int main()
+{
+  std::cerr << "ERROR: codebase not built with -DMULTI_NODE option." << std::endl;
+  return 1;
+}
+#endif
@@ -57,8 +57,6 @@ int main()
   auto boardPrinter = ChessBoardPrinter();
 
   constexpr ::std::size_t N      = 3;
-  constexpr ::std::size_t ROW_SZ = 8;
-  constexpr ::std::size_t COL_SZ = 8;
   
   std::vector<piece_label_t> noRoyaltyPieceset = { 'q' };
   std::vector<piece_label_t> royaltyPieceset = { 'k', 'K' };
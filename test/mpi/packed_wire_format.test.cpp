@@ -0,0 +1,102 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Checks that packed batches unpack to the same predecessors, including those that cannot be indexed,
+// and that a delta encoded batch takes a tenth of the bytes of the raw one.
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <cassert>
+
+#include "../../src/retrograde_analysis/wire_format.hpp"
+
+struct npd_t
+{
+  int enpassantRights = -1;
+};
+
+constexpr std::size_t BoardSz = 64;
+using board_t = BoardState<BoardSz, npd_t>;
+
+// laid out as NodeCommData, which needs MPI
+struct comm_data_t
+{
+  bool winLabel;
+  mutable short G;
+  board_t b;
+};
+
+bool operator==(const comm_data_t& x, const comm_data_t& y)
+{
+  return x.winLabel == y.winLabel && x.G == y.G && x.b == y.b;
+}
+
+std::vector<comm_data_t> roundTrip(const PackedWireFormat<BoardSz, comm_data_t>& wireFormat,
+    const std::vector<comm_data_t>& batch, std::size_t& packedSz)
+{
+  std::vector<unsigned char> bytes;
+  wireFormat.pack(batch.data(), batch.size(), bytes);
+  packedSz = bytes.size();
+  std::vector<comm_data_t> unpacked;
+  wireFormat.unpack(bytes.data(), bytes.size(), unpacked);
+  return unpacked;
+}
+
+int main()
+{
+  std::vector<piece_label_t> pieceSet = { 'k', 'K', 'r' };
+  MaterialIndexer<BoardSz> indexer(pieceSet);
+
+  // a sparse, shuffled batch with labels of both signs
+  std::vector<comm_data_t> batch;
+  for (position_index_t i = 0; i < indexer.size(); i += 97)
+  {
+    comm_data_t commData{ i % 2 == 0, static_cast<short>(static_cast<int>(i % 601) - 300), {} };
+    indexer.unrank(i, commData.b);
+    batch.push_back(commData);
+  }
+  std::shuffle(batch.begin(), batch.end(), std::mt19937(0));
+
+  // neither a board with en passant rights nor one with untracked material has an index
+  comm_data_t withRights = batch[0];
+  withRights.b.nonPlacementData.enpassantRights = 3;
+  batch.push_back(withRights);
+  comm_data_t untracked{ true, 5, {} };
+  untracked.b.m_board[0] = 'Q';
+  untracked.b.m_board[9] = 'k';
+  batch.push_back(untracked);
+
+  for (bool b_delta : { false, true })
+  {
+    PackedWireFormat<BoardSz, comm_data_t> wireFormat(indexer, b_delta);
+    std::size_t packedSz = 0;
+    auto unpacked = roundTrip(wireFormat, batch, packedSz);
+    assert(unpacked.size() == batch.size());
+    assert(std::is_permutation(unpacked.begin(), unpacked.end(), batch.begin()));
+    if (b_delta)
+      assert(packedSz * 10 <= batch.size() * sizeof(comm_data_t));
+  }
+
+  // an empty batch packs to nothing
+  PackedWireFormat<BoardSz, comm_data_t> wireFormat(indexer);
+  std::size_t packedSz = 0;
+  assert(roundTrip(wireFormat, {}, packedSz).empty() && packedSz == 0);
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,86 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Checks that the one-sided cluster solver labels every position of its slices as the dense single node
+// solver labels it over the same index space, given checkmates found with the same validity filter.
+// Run with mpirun and any number of processes.
+
+#include <iostream>
+
+#ifdef MULTI_NODE
+#include <cassert>
+
+#include "../../src/retrograde_analysis/retrograde_analysis.hpp"
+#include "../../src/retrograde_analysis/single_node_impl.hpp"
+#include "../../src/retrograde_analysis/state_transition.hpp"
+
+#include "../../src/rules/chess/interface.h"
+
+int main()
+{
+  MPI_Init(NULL, NULL);
+  int id = 0;
+  int numProcs = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &numProcs);
+
+  auto fwdMoveGenerator = ChessGenerateForwardMoves();
+  auto revMoveGenerator = ChessGenerateReverseMoves();
+  auto winCondEvaluator = ChessCheckmateEvaluator();
+  auto validityEvaluator = ChessValidBoardEvaluator();
+
+  constexpr ::std::size_t N = 3;
+  std::vector<piece_label_t> fullPieceset = { 'k', 'K', 'q' };
+
+  IndexRangeStateSpacePartition<64, ChessNPD> partitioner(MaterialIndexer<64>(fullPieceset), numProcs);
+  std::unordered_set<BoardState<64, ChessNPD>, BoardStateHasher<64, ChessNPD>> localCheckmates;
+  localCheckmates = generatePartitionCheckmates<64>(id, partitioner,
+      std::move(localCheckmates), fullPieceset, winCondEvaluator, validityEvaluator);
+  auto slice = retrogradeAnalysisClusterRmaImpl<64, ChessNPD, N, ROW_SZ, COL_SZ,
+    decltype(fwdMoveGenerator), decltype(revMoveGenerator)>(partitioner, id, numProcs,
+    localCheckmates, fwdMoveGenerator, revMoveGenerator);
+
+  // every rank solves the whole space on its own to check its slice against
+  auto checkmates = generateParallelConfigCheckmates<64, ChessNPD, N, ROW_SZ, COL_SZ,
+    decltype(winCondEvaluator), decltype(validityEvaluator)>(fullPieceset, winCondEvaluator, validityEvaluator);
+  DenseResultStore<64, ChessNPD> store{MaterialIndexer<64>(fullPieceset)};
+  retrogradeAnalysisBaseImpl<64, ChessNPD, N, ROW_SZ, COL_SZ,
+    decltype(fwdMoveGenerator), decltype(revMoveGenerator)>(store, std::move(checkmates),
+    fwdMoveGenerator, revMoveGenerator);
+
+  for (auto idx = partitioner.first(id); idx < partitioner.first(id) + partitioner.partSize(id); ++idx)
+    assert(slice.wdl(idx) == store.status(idx));
+
+  std::uint64_t local[2] = { slice.numWins(), slice.numLosses() };
+  std::uint64_t total[2] = { 0, 0 };
+  MPI_Reduce(local, total, 2, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (id == 0)
+  {
+    std::cout << "wins: " << total[0] << " losses: " << total[1] << std::endl;
+    assert(total[0] == store.numWins() && total[1] == store.numLosses());
+    std::cout << "test passed" << std::endl;
+  }
+  MPI_Finalize();
+  return 0;
+}
+
+#else
+int main()
+{
+  std::cerr << "ERROR: codebase not built with -DMULTI_NODE option." << std::endl;
+  return 1;
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Checks that every partition assigns each position of a material signature to exactly one valid
+// part, and that the hash and index range partitions stay balanced for part counts that do not divide
+// the board.
+
+#include <iostream>
+#include <vector>
+#include <cassert>
+
+#include "../../src/retrograde_analysis/state_space_partition.hpp"
+
+struct null_type {};
+
+constexpr std::size_t BoardSz = 64;
+using board_t = BoardState<BoardSz, null_type>;
+
+// counts the positions of each part over all placements of the pieceset with either side to move
+template <typename Partitioner>
+std::vector<std::size_t> partSizes(const Partitioner& partitioner, const std::vector<piece_label_t>& pieceSet)
+{
+  PositionIndexer<BoardSz> indexer(pieceSet);
+  std::vector<std::size_t> sizes(partitioner.numParts(), 0);
+  for (position_index_t i = 0; i < indexer.size(); ++i)
+  {
+    board_t b;
+    indexer.unrank(i, b);
+    auto part = partitioner(b);
+    assert(part >= 0 && part < partitioner.numParts());
+    ++sizes[part];
+  }
+  return sizes;
+}
+
+void assert_balanced(const std::vector<std::size_t>& sizes, double tolerance)
+{
+  std::size_t total = 0;
+  for (auto n : sizes)
+    total += n;
+  double average = static_cast<double>(total) / sizes.size();
+  for (auto n : sizes)
+    assert(n >= average * (1 - tolerance) && n <= average * (1 + tolerance));
+}
+
+int main()
+{
+  std::vector<piece_label_t> pieceSet = { 'k', 'K', 'r' };
+
+  // the last part takes the squares left over by the others
+  for (int numParts : { 1, 3, 7, 64 })
+  {
+    KStateSpacePartition<BoardSz, board_t> partitioner('k', numParts);
+    partSizes(partitioner, pieceSet);
+    assert(std::get<1>(partitioner.getRange(numParts - 1)) == static_cast<int>(BoardSz));
+  }
+
+  // with at least 5000 positions per part, the spread of a good hash stays well within 5%
+  for (int numParts : { 1, 3, 7, 100 })
+  {
+    HashStateSpacePartition<BoardSz, null_type> partitioner(numParts);
+    assert_balanced(partSizes(partitioner, pieceSet), 0.05);
+  }
+
+  for (int numParts : { 1, 3, 7, 100, 1000 })
+  {
+    IndexRangeStateSpacePartition<BoardSz, null_type> partitioner(MaterialIndexer<BoardSz>(pieceSet), numParts);
+    const auto& indexer = partitioner.indexer();
+
+    position_index_t total = 0;
+    for (int part = 0; part < numParts; ++part)
+    {
+      assert(partitioner.partSize(part) <= partitioner.maxPartSize());
+      total += partitioner.partSize(part);
+    }
+    assert(total == indexer.size());
+
+    // an index is found again from its part and offset
+    for (position_index_t i = 0; i < indexer.size(); ++i)
+    {
+      board_t b;
+      indexer.unrank(i, b);
+      auto part = partitioner(b);
+      assert(part == partitioner.owner(i));
+      assert(partitioner.first(part) + partitioner.offset(i) == i);
+    }
+  }
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,138 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Checks that the board placement reads back what was written and that the square
+// iteration helpers and hasher agree with it. Build with and without -DBITBOARD_STATE
+// and -DZOBRIST_HASHING; with bitboards both the 64 bit (chess) and 128 bit (xiangqi
+// sized) words are exercised.
+
+#include <iostream>
+#include <vector>
+#include <cassert>
+
+#include "../../src/retrograde_analysis/state.hpp"
+
+struct null_type {};
+
+struct npd_t
+{
+  int enpassantRights = -1;
+};
+
+template <std::size_t FlattenedSz>
+void check_placement()
+{
+  using board_t = BoardState<FlattenedSz, null_type>;
+  const std::vector<std::pair<std::size_t, piece_label_t>> pieces =
+    { { 0, 'R' }, { 4, 'K' }, { 60, 'k' }, { FlattenedSz - 1, 'q' }, { FlattenedSz - 2, 'P' } };
+
+  board_t b{};
+  b.m_player = true;
+  for (auto [sq, p] : pieces)
+    b.m_board[sq] = p;
+
+  for (auto [sq, p] : pieces)
+    assert(b.m_board.at(sq) == p);
+
+  std::size_t numPieces = 0;
+  for (piece_label_t p : b.m_board)
+    numPieces += !isEmpty(p);
+  assert(numPieces == pieces.size());
+
+  // overwrite and move a piece the way the PMOs do
+  b.m_board.at(5) = b.m_board.at(4);
+  b.m_board.at(4) = '\0';
+  assert(b.m_board[4] == '\0' && b.m_board[5] == 'K');
+  b.m_board[0] = 'n';
+  assert(b.m_board[0] == 'n');
+
+  std::vector<std::size_t> white;
+  forEachPieceOfColor(b, true, [&](std::size_t sq) { white.push_back(sq); return true; });
+  assert((white == std::vector<std::size_t>{ 5, FlattenedSz - 2 }));
+
+  std::size_t visited = 0;
+  assert(!forEachPieceOfColor(b, false, [&](std::size_t) { return ++visited < 2; }));
+  assert(visited == 2);
+
+  assert(isRoyalAt(b, 5) && isRoyalAt(b, 60) && !isRoyalAt(b, 0) && !isRoyalAt(b, 6));
+
+  // the same placement written in another order compares and hashes equal
+  board_t c{};
+  c.m_player = true;
+  c.m_board[FlattenedSz - 1] = 'q';
+  c.m_board[60] = 'k';
+  c.m_board[FlattenedSz - 2] = 'P';
+  c.m_board[0] = 'n';
+  c.m_board[5] = 'K';
+  assert(b == c);
+  BoardStateHasher<FlattenedSz, null_type> hasher;
+  assert(hasher(b) == hasher(c));
+
+#ifdef ZOBRIST_HASHING
+  // the incrementally updated key matches the key of the same placement built at once
+  std::array<piece_label_t, FlattenedSz> mailbox{};
+  for (std::size_t sq = 0; sq < FlattenedSz; ++sq)
+    mailbox[sq] = b.m_board[sq];
+  board_t fresh{ true, mailbox, {} };
+  assert(fresh.m_board.key() == b.m_board.key());
+#endif
+
+  c.m_player = false;
+  assert(hasher(b) != hasher(c) && !(b == c));
+  c.m_player = true;
+
+  c.m_board[5] = '\0';
+  assert(!(b == c));
+}
+
+// boards that differ only in the side to move or only in the non placement data are different positions
+template <std::size_t FlattenedSz>
+void check_distinct()
+{
+  using board_t = BoardState<FlattenedSz, npd_t>;
+  BoardStateHasher<FlattenedSz, npd_t> hasher;
+
+  board_t b{};
+  b.m_player = true;
+  b.m_board[4] = 'K';
+  b.m_board[60] = 'k';
+  b.m_board[FlattenedSz - 1] = 'P';
+
+  board_t c = b;
+  assert(b == c && hasher(b) == hasher(c));
+
+  c.m_player = false;
+  assert(!(b == c) && hasher(b) != hasher(c));
+
+  c = b;
+  c.nonPlacementData.enpassantRights = 20;
+  assert(!(b == c) && hasher(b) != hasher(c));
+
+  c.nonPlacementData.enpassantRights = -1;
+  assert(b == c && hasher(b) == hasher(c));
+}
+
+int main()
+{
+  check_placement<64>();
+  check_placement<90>();
+  check_distinct<64>();
+  check_distinct<80>();
+  check_distinct<90>();
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}
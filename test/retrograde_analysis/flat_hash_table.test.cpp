@@ -0,0 +1,106 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Checks the flat hash set and map against the node based standard containers,
+// including erasure, growth and the per slot bucket interface, and checks that
+// sharded sets and maps place each key in the same shard.
+
+#include <iostream>
+#include <vector>
+#include <unordered_set>
+#include <cassert>
+
+#include "../../src/retrograde_analysis/state.hpp"
+#include "../../src/retrograde_analysis/flat_hash_table.hpp"
+#include "../../src/retrograde_analysis/sharded_hash_table.hpp"
+
+struct null_type {};
+
+int main()
+{
+  using board_t = BoardState<16, null_type>;
+  using hasher_t = BoardStateHasher<16, null_type>;
+
+  // every placement of a king on 16 squares and a queen on another square, for both sides to move
+  std::vector<board_t> boards;
+  for (bool player : { false, true })
+  for (std::size_t k = 0; k < 16; ++k)
+  for (std::size_t q = 0; q < 16; ++q)
+  {
+    if (k == q)
+      continue;
+    board_t b;
+    b.m_player = player;
+    b.m_board[k] = 'K';
+    b.m_board[q] = 'q';
+    boards.push_back(b);
+  }
+
+  FlatHashSet<board_t, hasher_t> set;
+  for (const auto& b : boards)
+    assert(set.insert(b).second);
+  for (const auto& b : boards)
+    assert(!set.insert(b).second);
+  assert(set.size() == boards.size());
+
+  // erase every other board so that lookups have to probe past deleted slots
+  for (std::size_t i = 0; i < boards.size(); i += 2)
+    assert(set.erase(boards[i]) == 1);
+  for (std::size_t i = 0; i < boards.size(); ++i)
+    assert(set.contains(boards[i]) == (i % 2 == 1));
+  assert(set.size() == boards.size() / 2);
+
+  // iterating over all buckets visits each element once
+  std::unordered_set<board_t, hasher_t> visited;
+  for (std::size_t i = 0; i < set.bucket_count(); ++i)
+  for (auto it = set.begin(i); it != set.end(i); ++it)
+    assert(visited.insert(*it).second);
+  assert(visited.size() == set.size());
+
+  FlatHashSet<board_t, hasher_t> copy(set);
+  set.clear();
+  assert(set.empty() && copy.size() == visited.size());
+  for (const auto& b : visited)
+    assert(copy.find(b) != copy.end());
+
+  FlatHashMap<board_t, int, hasher_t> depths;
+  for (std::size_t i = 0; i < boards.size(); ++i)
+    depths[boards[i]] = static_cast<int>(i);
+  for (std::size_t i = 0; i < boards.size(); ++i)
+    assert(depths.at(boards[i]) == static_cast<int>(i));
+  ++depths[boards[0]];
+  assert(depths.at(boards[0]) == 1);
+  assert(depths.size() == boards.size());
+
+  ShardedHashSet<board_t, hasher_t> shardedSet(boards.begin(), boards.end());
+  ShardedHashMap<board_t, int, hasher_t> shardedDepths;
+  for (const auto& b : boards)
+    shardedDepths[b] = 0;
+  assert(shardedSet.size() == boards.size() && shardedDepths.size() == boards.size());
+
+  std::size_t numVisited = 0;
+  for (const auto& b : shardedSet)
+  {
+    auto s = shardedSet.shardIndex(b);
+    assert(s == shardedDepths.shardIndex(b));
+    assert(shardedSet.shard(s).contains(b) && shardedDepths.shard(s).contains(b));
+    ++numVisited;
+  }
+  assert(numVisited == boards.size());
+  assert(shardedDepths.find(boards[1]) != shardedDepths.end());
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}
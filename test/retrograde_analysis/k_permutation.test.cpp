@@ -0,0 +1,74 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Checks that the k-permutation enumerator walks the placements in the order of a next_permutation walk over
+// all squares, and that unrank and index agree with that order at every position.
+
+#include <iostream>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <cassert>
+
+#include "../../src/retrograde_analysis/state.hpp"
+#include "../../src/retrograde_analysis/permutation_generator.hpp"
+
+template <std::size_t FlattenedSz>
+void assert_order(std::size_t k, std::uint64_t gold)
+{
+  KPermutation<FlattenedSz> placement(k);
+  assert(placement.size() == gold);
+
+  std::array<std::size_t, FlattenedSz> squares;
+  std::iota(squares.begin(), squares.end(), 0);
+
+  KPermutation<FlattenedSz> indexed(k);
+  std::uint64_t i = 0;
+  bool hasNext = true;
+  for (; hasNext; ++i)
+  {
+    indexed.unrank(i);
+    for (std::size_t j = 0; j < k; ++j)
+    {
+      assert(placement[j] == squares[j]);
+      assert(indexed[j] == squares[j]);
+    }
+    assert(placement.index() == i);
+
+    std::reverse(squares.begin() + k, squares.end());
+    hasNext = std::next_permutation(squares.begin(), squares.end());
+    assert(placement.next() == hasNext);
+  }
+  assert(i == gold);
+
+  // wraps around to the first placement
+  assert(placement.index() == 0);
+}
+
+int main()
+{
+  // 6 * 5 * 4
+  assert_order<6>(3, 120);
+  assert_order<6>(6, 720);
+  assert_order<9>(1, 9);
+  // 12 * 11 * 10 * 9
+  assert_order<12>(4, 11880);
+  // 16 * 15 * 14
+  assert_order<16>(3, 3360);
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}
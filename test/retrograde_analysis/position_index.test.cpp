@@ -0,0 +1,98 @@
+/*
+* Copyright 2022 SCRAP
+*
+* This file is part of Scrappy Tablebase Generator.
+*
+* Scrappy Tablebase Generator is free software: you can redistribute it and/or modify it under the terms
+* of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,
+* or (at your option) any later version.
+*
+* Scrappy Tablebase Generator is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with Scrappy Tablebase Generator. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Checks that the position indexer is a bijection between [0, size()) and the
+// placements of a material signature, and that captures are registered.
+
+#include <iostream>
+#include <vector>
+#include <cassert>
+
+#include "../../src/retrograde_analysis/state.hpp"
+#include "../../src/retrograde_analysis/position_index.hpp"
+
+struct null_type {};
+
+struct npd_t
+{
+  int enpassantRights = -1;
+};
+
+template <std::size_t FlattenedSz>
+void assert_bijection(const std::vector<piece_label_t>& pieceSet, position_index_t gold)
+{
+  PositionIndexer<FlattenedSz> indexer(pieceSet);
+  assert(indexer.size() == gold);
+
+  std::vector<bool> visited(indexer.size(), false);
+  for (position_index_t i = 0; i < indexer.size(); ++i)
+  {
+    BoardState<FlattenedSz, null_type> b;
+    indexer.unrank(i, b);
+
+    std::size_t numPieces = 0;
+    for (const auto& c : b.m_board)
+      numPieces += !isEmpty(c);
+    assert(numPieces == pieceSet.size());
+
+    auto idx = indexer.rank(b);
+    assert(idx == i);
+    assert(!visited[idx]);
+    visited[idx] = true;
+  }
+}
+
+int main()
+{
+  // 2 * 16 * 15 * 14
+  assert_bijection<16>({ 'K', 'k', 'Q' }, 6720);
+  // identical pieces are not double counted: 2 * 16 * 15 * C(14, 2)
+  assert_bijection<16>({ 'K', 'k', 'R', 'R' }, 43680);
+  // 2 * 20 * 19 * C(18, 2) * 16
+  assert_bijection<20>({ 'K', 'k', 'p', 'Q', 'p' }, 1860480);
+
+  // KRkq and all captures: KRkq, KRk, Kkq, Kk
+  MaterialIndexer<64> materialIndexer(std::vector<piece_label_t>{ 'K', 'k', 'R', 'q' });
+  assert(materialIndexer.numSignatures() == 4);
+  assert(materialIndexer.size() == 2 * (64ull*63*62*61 + 2 * 64*63*62 + 64*63));
+
+  BoardState<64, null_type> b;
+  b.m_player = true;
+  b.m_board[4] = 'K';
+  b.m_board[60] = 'k';
+  b.m_board[0] = 'R';
+  auto idx = materialIndexer(b);
+  assert(idx != NULL_POSITION_INDEX);
+
+  BoardState<64, null_type> unranked;
+  materialIndexer.unrank(idx, unranked);
+  assert(unranked.m_board == b.m_board && unranked.m_player == b.m_player);
+
+  // a material signature that was not registered
+  b.m_board[1] = 'N';
+  assert(materialIndexer(b) == NULL_POSITION_INDEX);
+
+  // indices do not hold the non placement data, so only boards with the default data are indexed
+  BoardState<64, npd_t> withData{};
+  withData.m_board[4] = 'K';
+  withData.m_board[60] = 'k';
+  assert(materialIndexer(withData) != NULL_POSITION_INDEX);
+  withData.nonPlacementData.enpassantRights = 20;
+  assert(materialIndexer(withData) == NULL_POSITION_INDEX);
+
+  std::cout << "test passed" << std::endl;
+  return 0;
+}